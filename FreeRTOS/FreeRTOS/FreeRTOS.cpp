@@ -13,6 +13,14 @@
 #include "freertos/semphr.h"
 #include "freertos/timers.h"
 #include "esp_sleep.h"
+#include "freertos/message_buffer.h"
+#include "freertos/stream_buffer.h"
+#include <atomic>
+#include <LittleFS.h>
+#include <Preferences.h>
+#include "driver/rtc_io.h"
+#include "esp_freertos_hooks.h"
+#include "esquema_trama.h"
 
 // Definición de pines
 #define DHTPIN 4         ///< Pin de datos del sensor DHT11
@@ -21,6 +29,152 @@
 #define DHTTYPE DHT11    ///< Tipo de sensor DHT (DHT11)
 #define BUTTON_PIN_1 18  ///< Primer botón para interrupción
 #define BUTTON_PIN_2 19  ///< Segundo botón para interrupción
+#define RTC_INT_PIN GPIO_NUM_33  ///< Pin INT/SQW del DS3231 (debe ser un GPIO RTC para ext0)
+
+// Configuración del Deep Sleep
+#define PERIODO_SLEEP_S 30           ///< Periodo entre despertares (s)
+#define DESPERTAR_POR_ALARMA_RTC 0   ///< 1: despertar con la alarma 1 del DS3231 por ext0; 0: timer del ESP32
+#define ALARMA_MARGEN_S 2            ///< Margen mínimo hasta la alarma (si no, se salta al siguiente múltiplo)
+#define ALARMA_RESPALDO_S 2          ///< El timer de respaldo despierta estos segundos después de la alarma
+#define MEDIR_JITTER_DESPERTAR 0     ///< 1: medir al arrancar el desfase respecto al instante previsto
+
+// Sincronización de hora con el host por el enlace serie
+#define SYNC_ACTIVO 1                ///< 1: estimar offset y deriva del DS3231 frente al host
+#define SYNC_PERIODO_S 300           ///< Tiempo mínimo entre sincronizaciones (s de DS3231)
+#define SYNC_INTENTOS 3              ///< Intercambios por sincronización (se usa el de menor retardo)
+#define SYNC_ESPERA_MS 1000          ///< Espera máxima de la respuesta del host
+#define SYNC_RETARDO_MAX_MS 200      ///< Retardo de ida y vuelta por encima del cual se descarta el intercambio
+#define SYNC_MUESTRAS 8              ///< Offsets que se conservan para estimar la deriva
+
+// Configuración del registro de escritura anticipada (WAL)
+#define WAL_RUTA "/wal.log"          ///< Archivo del WAL en LittleFS
+#define WAL_GRUPO_MAX_TRAMAS 4       ///< Tramas por grupo antes de forzar el commit
+#define WAL_GRUPO_BYTES 512          ///< Bytes por grupo antes de forzar el commit
+#define WAL_VENTANA_MS 10000         ///< Ventana máxima de durabilidad de un grupo (ms)
+#define WAL_MAX_BYTES 65536          ///< Tamaño máximo del WAL antes de descartar tramas
+#define WAL_REG_TEXTO 1              ///< Tipo de registro: trama de texto (formato anterior, sin secuencia)
+#define WAL_REG_TRAMA 2              ///< Tipo de registro: número de secuencia + trama de texto
+#define WAL_REG_BINARIO 3            ///< Tipo de registro: número de secuencia + TramaBinaria (sin formatear)
+#define WAL_REG_EMPAQUETADO 4        ///< Tipo de registro: número de secuencia + trama según EsquemaTramaV1 (solo lectura)
+#define WAL_REG_EMPAQUETADO_V2 5     ///< Tipo de registro: número de secuencia + trama según EsquemaTrama
+#define WAL_CABECERA 6               ///< Bytes de cabecera de los registros con número de secuencia
+#define TRAMA_MAX 256                ///< Longitud máxima de una trama de texto, incluido '\0' (el WAL guarda la longitud en un byte)
+#define TRAMA_BUFFER_BYTES 512       ///< Capacidad del message buffer de tramas
+#define TRAMA_TEXTO_BINARIA_MAX 96   ///< Cota del texto generado a partir de una TramaBinaria
+#define CONSOLA_CONECTADA 1          ///< 1: consola de texto conectada al arrancar; 0: equipo sin consola hasta que el host la pida
+#define REPORTES_ACTIVOS 1           ///< 1: informes antes de dormir (solo con consola conectada); 0: no se compilan
+
+// Fusión de temperatura DS3231 + DHT11 (valores en centésimas de °C)
+#define DHT_PERIODO_MIN_MS 2000      ///< Periodo del DHT11 cuando las lecturas no concuerdan
+#define DHT_PERIODO_MAX_MS 16000     ///< Periodo máximo del DHT11 cuando concuerdan
+#define FUSION_TOLERANCIA 100        ///< Diferencia admitida respecto al offset estimado (1.00 °C)
+#define FUSION_ACUERDOS 3            ///< Lecturas concordantes antes de duplicar el periodo
+#define FUSION_K 2                   ///< Ganancia del filtro del offset: 1/2^K
+
+// Coordinador de muestreo (rejilla de fase común)
+#define MUESTREO_ALINEADO 1          ///< 1: todas las lecturas en la misma ventana; 0: cada tarea con su vTaskDelay
+#define MUESTREO_BASE_MS 1000        ///< Periodo de la rejilla común
+#define MUESTREO_HOLGURA_MS 100      ///< Desvío admitido al redondear un periodo a la rejilla
+#define MUESTREO_MAX_TAREAS 6        ///< Tareas periódicas que puede coordinar
+#define MUESTREO_VENTANA_US 2000     ///< Despertares más cercanos que esto cuentan como una sola ventana
+#define MUESTREO_CUBETAS 13          ///< Cubetas log2 del histograma de huecos entre despertares coordinados (ms)
+
+// Análisis de parpadeo de la luz (captura rápida del LDR + FFT)
+#define PARPADEO_ACTIVO 1            ///< 1: crear la tarea de análisis de parpadeo
+#define PARPADEO_MUESTRAS 256        ///< Muestras por bloque (potencia de 2)
+#define PARPADEO_FRECUENCIA_HZ 2000  ///< Frecuencia de muestreo del bloque (resolución = Fs / N)
+#define PARPADEO_PERIODO_MS 60000    ///< Periodo entre capturas, contando el Deep Sleep (ciclo de trabajo ~0.2 %)
+#define PARPADEO_PRIORIDAD_CAPTURA 2 ///< Prioridad durante la captura (no por encima de tareaAlarma)
+
+// Números de secuencia
+#define SECUENCIA_BLOQUE 1000        ///< Secuencias reservadas en NVS por cada escritura
+
+// Configuración de la repetición selectiva (ARQ) del enlace
+#define ARQ_VENTANA 8                ///< Tramas enviadas sin confirmar
+#define ARQ_ARENA_BYTES 1024         ///< Bytes de texto reservados para las tramas sin confirmar
+#define ARQ_TIMEOUT_MS 3000          ///< Espera de confirmación antes de retransmitir
+#define ARQ_INACTIVO_MS 30000        ///< Silencio del host tras el que se desactiva ARQ
+
+// Reglas de alarma (bits)
+#define ALARMA_REGLA_TEMP_HUM (1 << 0)  ///< temp > 24 y hum > 70
+#define ALARMA_REGLA_LUZ (1 << 1)       ///< luz > 500
+#define ALARMA_SEVERIDAD_AVISO (1 << 8)    ///< Una regla activa
+#define ALARMA_SEVERIDAD_CRITICA (1 << 9)  ///< Varias reglas activas a la vez
+#define ALARMA_CON_SEMAFORO 0              ///< 1: señalizar con ledSemaphore (sin reglas) para comparar latencias
+#define MEDIR_LATENCIA_LOOPBACK 0          ///< 1: medir el flanco real del LED en LOOPBACK_PIN
+#define LOOPBACK_PIN 23                    ///< Entrada cableada a LED_PIN para la medida por loopback
+#define LATENCIA_CUBETAS 14                ///< Cubetas log2 (ms) de los histogramas de latencia
+
+// Ejecución sin hardware (emulador QEMU del ESP32) y medidas por commit
+#define SIMULAR_PERIFERICOS 0        ///< 1: DHT11, LDR y DS3231 sintéticos (QEMU no los emula)
+#define BENCH_TAREAS 0               ///< 1: medir al arrancar los ciclos de los cuerpos de las tareas
+#define BENCH_TAREAS_REPETICIONES 50 ///< Repeticiones por medida (se reporta el mínimo)
+
+// Controlador de carga (descarte escalonado)
+#define CARGA_CONTROL_ACTIVO 1       ///< 1: vigilar colas y CPU y descartar trabajo por niveles
+#define CARGA_PERIODO_MS 500         ///< Periodo de evaluación del controlador
+#define CARGA_OCUPACION_ALTA 75      ///< Ocupación (%) de la cola más llena que sube un nivel
+#define CARGA_OCUPACION_BAJA 25      ///< Ocupación (%) por debajo de la cual se baja un nivel
+#define CARGA_CPU_ALTA 90            ///< Uso de CPU (%) que sube un nivel
+#define CARGA_CPU_BAJA 60            ///< Uso de CPU (%) por debajo del cual se baja un nivel
+
+// Contrapresión por créditos entre productores y consumidores de sensores
+#define SENSOR_COLA_LONGITUD 10      ///< Elementos de sensorQueue (créditos iniciales de los sensores)
+#define RTC_COLA_LONGITUD 5          ///< Elementos de rtcQueue (créditos iniciales del RTC)
+#define ENLACE_COLA_LONGITUD 8       ///< Elementos de enlaceQueue
+#define ALARMA_COLA_LONGITUD 4       ///< Elementos de alarmaQueue
+
+// Presupuesto de memoria del pipeline (las longitudes anteriores son las preferidas)
+#define PRESUPUESTO_ACTIVO 1         ///< 1: repartir colas y buffers desde PRESUPUESTO_BYTES al arrancar
+#define PRESUPUESTO_BYTES 2048       ///< Memoria total para colas y buffers del pipeline
+#define PRESUPUESTO_MARGEN_PCT 50    ///< Margen sobre el pico observado en la ejecución anterior
+
+// Ensamblado de tramas por tiempo de evento (join con marcas de agua)
+#define JOIN_RETRASO_MAX_MS 2000      ///< Retraso admitido de una muestra respecto al evento más reciente
+#define JOIN_TICKS_MAX 8              ///< Ticks del RTC pendientes de ensamblar
+#define JOIN_PERIODO_MS 5000          ///< Intervalo entre tramas (ticks del RTC que se ensamblan)
+#define JOIN_COLA_LONGITUD 8          ///< Elementos de joinQueue
+#define JOIN_HISTORIA 4               ///< Muestras recientes que se conservan por canal
+
+// Perfilado de ocupación de las colas (recomendación de longitudes)
+#define PERFIL_COLAS 0                ///< 1: registrar histogramas de ocupación y recomendar longitudes
+#define PERFIL_PERIODO_MS 10          ///< Periodo de muestreo de la ocupación
+#define PERFIL_CUBETAS 32             ///< Ocupaciones registradas (la última acumula las mayores)
+#define PERFIL_PROB_DESBORDE_PPM 1000 ///< Probabilidad de desborde objetivo (partes por millón)
+
+// Salidas (sinks) registradas sobre el flujo común de tramas
+#define SINK_MAX 4                   ///< Salidas que se pueden registrar
+#define SINK_PILA 2048               ///< Pila de la tarea de cada salida sin tarea propia
+#define SINK_SERIE_PERIODO_MS 5000   ///< Intervalo entre lotes de la consola serie
+#define SINK_SERIE_LOTE 1            ///< Tramas por lote de la consola serie
+#define SINK_DIAG_ACTIVO 1           ///< 1: registrar la salida de diagnóstico
+#define SINK_DIAG_PERIODO_MS 60000   ///< Intervalo entre resúmenes de diagnóstico
+#define SINK_DIAG_LOTE 16            ///< Tramas máximas por resumen
+#define SINK_DIAG_BUFFER_BYTES 384   ///< Presupuesto del buffer de la salida de diagnóstico
+
+// Informe de huella de memoria y presupuestos
+#define HUELLA_MEMORIA 1             ///< 1: informe de pilas, colas, heap y secciones antes de dormir
+#define HUELLA_MAX_TAREAS 16         ///< Tareas que puede registrar el informe
+#define HUELLA_MAX_COLAS 8           ///< Colas y buffers que puede registrar el informe
+#define HUELLA_PILA_LIBRE_MIN 256    ///< Presupuesto: bytes que deben quedar libres en cada pila
+#define HUELLA_HEAP_LIBRE_MIN 32768  ///< Presupuesto: mínimo histórico de heap libre (bytes)
+#define HUELLA_ESTATICA_MAX 65536    ///< Presupuesto: .data + .bss en DRAM (bytes)
+#define HUELLA_FLASH_MAX 1048576     ///< Presupuesto: tamaño de la imagen en flash (bytes)
+#define HUELLA_ESTRICTA 0            ///< 1: abortar (panic) si se supera un presupuesto; para banco y QEMU
+
+// Benchmark de primitivas de comunicación
+#define BENCH_COLAS 0                ///< 1: arrancar solo el benchmark de colas en lugar del sistema
+#define BENCH_ITERACIONES 2000       ///< Transferencias por medida
+
+// Configuración del volcado masivo (backfill) del WAL
+#define BACKFILL_UMBRAL_BYTES 2048   ///< Pendiente mínimo del WAL para usar backfill en vez de texto
+#define BACKFILL_BLOQUE 512          ///< Bytes de WAL por bloque enviado
+#define BACKFILL_VENTANA 4           ///< Bloques enviados sin confirmar
+#define BACKFILL_ESPERA_MS 3000      ///< Espera máxima de la aceptación del host
+#define BACKFILL_TIMEOUT_MS 500      ///< Espera de confirmación antes de reenviar la ventana
+#define BACKFILL_REINTENTOS 5        ///< Reenvíos consecutivos antes de abortar
+#define BACKFILL_CABECERA 6          ///< Magia, índice y longitud de cada bloque
+#define BACKFILL_COLA 2              ///< CRC-16 de cada bloque
 
 DHT dht(DHTPIN, DHTTYPE);  ///< Objeto sensor DHT
 RTC_DS3231 rtc;            ///< Objeto RTC DS3231
@@ -28,12 +182,33 @@ RTC_DS3231 rtc;            ///< Objeto RTC DS3231
 // Colas y semáforos
 QueueHandle_t sensorQueue;  ///< Cola para datos de sensores (temperatura, humedad, luz)
 QueueHandle_t rtcQueue;     ///< Cola para datos del RTC (fecha y hora)
-QueueHandle_t tramaQueue;   ///< Cola para tramas formateadas completas
+QueueHandle_t joinQueue;    ///< Copia de muestras y ticks para el ensamblado de tramas
+SemaphoreHandle_t creditosSensor;  ///< Créditos de sensorQueue: elementos que los consumidores pueden procesar
+SemaphoreHandle_t creditosRtc;     ///< Créditos de rtcQueue
+MessageBufferHandle_t tramaBuffer;  ///< Buffer de tramas de la consola serie (longitud variable)
+QueueHandle_t enlaceQueue;  ///< Cola de comandos recibidos del host (ACK/NACK)
+QueueHandle_t alarmaQueue;  ///< Carril prioritario del enlace: eventos de alarma
+SemaphoreHandle_t enlaceMutex;  ///< Evita que se mezclen escrituras de distintos carriles
+SemaphoreHandle_t nvsMutex;     ///< Serializa el uso del objeto Preferences compartido
+#if ALARMA_CON_SEMAFORO
 SemaphoreHandle_t ledSemaphore; ///< Semáforo binario para controlar el LED de alarma
+#endif
+TaskHandle_t tareaAlarmaHandle; ///< Destino de las notificaciones de alarma
+SemaphoreHandle_t walMutex;     ///< Mutex que protege el archivo y el grupo del WAL
 
 // Variables persistentes en Deep Sleep para que los datos se conserven despues de estar en este modo
 RTC_DATA_ATTR int contador = 0;     ///< Contador de pulsaciones persistente
 RTC_DATA_ATTR int wakeCounter = 0;  ///< Contador de reinicios persistente
+RTC_DATA_ATTR uint32_t walEntregado = 0; ///< Offset del WAL hasta el que las tramas ya se emitieron
+RTC_DATA_ATTR bool secuenciaValida = false;      ///< Los contadores de secuencia sobrevivieron al Deep Sleep
+RTC_DATA_ATTR uint32_t secuenciaMuestra = 0;     ///< Próxima secuencia de muestra
+RTC_DATA_ATTR uint32_t secuenciaTrama = 0;       ///< Próxima secuencia de trama
+RTC_DATA_ATTR uint32_t secuenciaReservada = 0;   ///< Límite de secuencias reservado en NVS
+RTC_DATA_ATTR uint32_t despertarObjetivo = 0;    ///< Instante previsto del próximo despertar (unixtime)
+RTC_DATA_ATTR uint32_t jitterMuestras = 0;       ///< Despertares medidos
+RTC_DATA_ATTR int32_t jitterMinMs = INT32_MAX;   ///< Desfase mínimo medido (ms)
+RTC_DATA_ATTR int32_t jitterMaxMs = INT32_MIN;   ///< Desfase máximo medido (ms)
+RTC_DATA_ATTR int64_t jitterSumaMs = 0;          ///< Suma de desfases para el promedio
 
 /**
  * @struct SensorData
@@ -46,237 +221,2977 @@ struct SensorData {
   float temperature; 
   float humidity;    
   int light;         
+  uint32_t secuencia;  ///< Número de secuencia de la muestra
+  uint32_t capturaUs;  ///< Instante de la lectura más antigua incluida (micros), para medir latencias extremo a extremo
+  uint16_t muestras;   ///< Lecturas resumidas en este envío (los valores son su media)
+};
+
+/**
+ * @struct AgregadoSensor
+ * @brief Lecturas acumuladas por un productor mientras no tiene crédito
+ * 
+ * Con la contrapresión por créditos el productor sigue leyendo a su ritmo y,
+ * si el consumidor no ha anunciado capacidad, resume las lecturas en lugar
+ * de bloquearse o descartarlas.
+ */
+struct AgregadoSensor {
+  float sumaTemperatura;  ///< Suma de temperaturas
+  float sumaHumedad;      ///< Suma de humedades
+  int32_t sumaLuz;        ///< Suma de niveles de luz
+  uint16_t muestras;      ///< Lecturas acumuladas
+  uint32_t capturaUs;     ///< Instante de la primera lectura acumulada
+
+  /**
+   * @brief Añade una lectura al resumen
+   */
+  void anotar(float temperatura, float humedad, int luz, uint32_t us) {
+    if (muestras == 0) capturaUs = us;
+    sumaTemperatura += temperatura;
+    sumaHumedad += humedad;
+    sumaLuz += luz;
+    muestras++;
+  }
+
+  /**
+   * @brief Construye el SensorData con la media de las lecturas y vacía el resumen
+   */
+  SensorData extraer(uint32_t secuencia) {
+    SensorData data = {sumaTemperatura / muestras, sumaHumedad / muestras,
+                       (int)(sumaLuz / muestras), secuencia, capturaUs, muestras};
+    *this = AgregadoSensor();
+    return data;
+  }
+};
+
+/**
+ * @struct RTCData
+ * @brief Estructura para almacenar datos de fecha y hora
+ * 
+ * Esta estructura se usa para enviar datos a través de rtcQueue.
+ */
+struct RTCData {
+  int hour;    ///< Hora actual 
+  int minute;  ///< Minutos actuales 
+  int second;  ///< Segundos actuales 
+  int day;     ///< Día del mes 
+  int month;   ///< Mes actual 
+  int year;    ///< Año actual 
+  int temperaturaRtc;  ///< Temperatura interna del DS3231 (centésimas de °C)
+  uint32_t capturaUs;  ///< Instante de la lectura (micros): tiempo de evento del tick
+};
+
+/**
+ * @struct EventoJoin
+ * @brief Muestra o tick del RTC reenviado al ensamblado de tramas
+ * 
+ * Esta estructura se usa para enviar datos a través de joinQueue: tareaMostrar
+ * es la única consumidora de sensorQueue y rtcQueue y reenvía cada elemento,
+ * así el ensamblado ve el flujo completo sin competir por las colas.
+ */
+struct EventoJoin {
+  bool esTick;         ///< true: tick del RTC; false: muestra de sensores
+  union {
+    SensorData muestra;  ///< Muestra (si !esTick)
+    RTCData tick;        ///< Tick del RTC (si esTick)
+  };
+};
+
+uint32_t joinDescartadas = 0;  ///< Elementos que no cupieron en joinQueue
+
+/**
+ * @struct TramaLog
+ * @brief Trama formateada junto con su posición en el WAL
+ * 
+ * Esta estructura se usa para enviar tramas a través de tramaBuffer. Solo se
+ * copian la cabecera y los caracteres usados del texto (sin el '\0'), así cada
+ * mensaje ocupa lo que mide la trama.
+ * Las tramas que no pudieron registrarse en el WAL llevan inicio = fin = UINT32_MAX.
+ */
+struct TramaLog {
+  uint32_t inicio;        ///< Offset del registro dentro del WAL
+  uint32_t fin;           ///< Offset del final del registro dentro del WAL
+  uint32_t secuencia;     ///< Número de secuencia de la trama
+  uint8_t tipo;           ///< Contenido de texto: WAL_REG_TRAMA (texto), WAL_REG_BINARIO o WAL_REG_EMPAQUETADO(_V2)
+  char texto[TRAMA_MAX];  ///< Trama de texto terminada en '\0', o los bytes de la trama sin formatear
+};
+
+#define TRAMA_CABECERA_MSG offsetof(TramaLog, texto)  ///< Bytes de cabecera de un mensaje de tramaBuffer
+
+/**
+ * @struct TramaBinaria
+ * @brief Contenido de una trama sin formatear
+ * 
+ * Es la forma de trabajo en memoria; en el WAL y en tramaBuffer viaja
+ * empaquetada según EsquemaTrama (esquema_trama.h). El texto solo se genera
+ * en la salida, y solo si hay una consola de texto conectada. Los valores
+ * con decimales van en centésimas.
+ */
+struct __attribute__((packed)) TramaBinaria {
+  uint16_t year;        ///< Año
+  uint8_t month;        ///< Mes
+  uint8_t day;          ///< Día del mes
+  uint8_t hour;         ///< Hora
+  uint8_t minute;       ///< Minutos
+  uint8_t second;       ///< Segundos
+  int16_t temperatura;  ///< Temperatura (centésimas de °C, -100 si no hay lectura)
+  int16_t humedad;      ///< Humedad (centésimas de %, -100 si no hay lectura)
+  int16_t luz;          ///< Nivel de luz (-1 si no hay lectura)
+};
+
+/**
+ * @struct EventoAlarma
+ * @brief Cambio de estado de las reglas de alarma
+ * 
+ * Esta estructura se usa para enviar eventos a través de alarmaQueue,
+ * el carril de mayor prioridad del enlace.
+ */
+struct EventoAlarma {
+  uint8_t reglas;      ///< Reglas activas tras el cambio (ALARMA_REGLA_*)
+  uint32_t muestra;    ///< Secuencia de la muestra que provocó el cambio
+  uint32_t creadoUs;   ///< Instante en que se generó el evento (micros)
+};
+
+/**
+ * @brief Devuelve la cubeta logarítmica de un valor: 0 para 0, i para [2^(i-1), 2^i)
+ * 
+ * La última cubeta acumula todo lo que no cabe en las anteriores.
+ */
+int cubetaLog2(uint32_t valor, int cubetas) {
+  int cubeta = 0;
+  while (valor > 0 && cubeta < cubetas - 1) {
+    valor >>= 1;
+    cubeta++;
+  }
+  return cubeta;
+}
+
+/**
+ * @struct HistogramaLatencia
+ * @brief Distribución de latencias en cubetas log2 de milisegundos
+ */
+struct HistogramaLatencia {
+  uint32_t cubetas[LATENCIA_CUBETAS];  ///< Cuentas por cubeta (ms)
+  uint32_t minUs;                      ///< Latencia mínima
+  uint32_t maxUs;                      ///< Latencia máxima
+  uint64_t sumaUs;                     ///< Suma para el promedio
+  uint32_t muestras;                   ///< Latencias anotadas
+};
+
+/**
+ * @brief Añade una latencia al histograma
+ */
+void latenciaAnotar(HistogramaLatencia &h, uint32_t us) {
+  if (h.muestras == 0 || us < h.minUs) h.minUs = us;
+  if (us > h.maxUs) h.maxUs = us;
+  h.sumaUs += us;
+  h.muestras++;
+  h.cubetas[cubetaLog2(us / 1000, LATENCIA_CUBETAS)]++;
+}
+
+/**
+ * @brief Muestra un histograma de latencias por serial
+ */
+void latenciaReportar(const char *nombre, const HistogramaLatencia &h) {
+  if (h.muestras == 0) return;
+  Serial.printf("%s: min %lu us, media %lu us, max %lu us, n %lu |", nombre,
+                (unsigned long)h.minUs, (unsigned long)(h.sumaUs / h.muestras),
+                (unsigned long)h.maxUs, (unsigned long)h.muestras);
+  for (int i = 0; i < LATENCIA_CUBETAS; i++) {
+    if (h.cubetas[i] > 0) {
+      Serial.printf(" <%lums:%lu", (unsigned long)(1UL << i), (unsigned long)h.cubetas[i]);
+    }
+  }
+  Serial.println();
+}
+
+/**
+ * @struct HuellaTarea
+ * @brief Tarea registrada en el informe de huella de memoria
+ */
+struct HuellaTarea {
+  const char *nombre;      ///< Nombre de la tarea
+  TaskHandle_t handle;     ///< NULL si la tarea ya terminó
+  uint32_t pila;           ///< Pila asignada (bytes)
+  uint32_t libreMin;       ///< Pila libre mínima observada (bytes)
+};
+
+/**
+ * @struct HuellaCola
+ * @brief Almacenamiento reservado por una cola o un buffer
+ */
+struct HuellaCola {
+  const char *nombre;  ///< Nombre de la cola
+  uint32_t bytes;      ///< Bytes de almacenamiento
+};
+
+HuellaTarea huellaTareas[HUELLA_MAX_TAREAS];  ///< Tareas registradas
+int huellaNumTareas = 0;                      ///< Entradas usadas de huellaTareas
+HuellaCola huellaColas[HUELLA_MAX_COLAS];     ///< Colas registradas
+int huellaNumColas = 0;                       ///< Entradas usadas de huellaColas
+
+// Límites de las secciones de DRAM definidos por el script del enlazador
+extern "C" char _data_start, _data_end, _bss_start, _bss_end;
+
+/**
+ * @brief Crea una tarea y la registra en el informe de huella
+ */
+BaseType_t crearTarea(TaskFunction_t funcion, const char *nombre, uint32_t pila,
+                      void *parametro, UBaseType_t prioridad, TaskHandle_t *handle = NULL) {
+  TaskHandle_t creada = NULL;
+  BaseType_t ok = xTaskCreate(funcion, nombre, pila, parametro, prioridad, &creada);
+  if (ok == pdPASS && huellaNumTareas < HUELLA_MAX_TAREAS) {
+    huellaTareas[huellaNumTareas++] = {nombre, creada, pila, pila};
+  }
+  if (handle) *handle = creada;
+  return ok;
+}
+
+/**
+ * @brief Anota la pila libre de la tarea actual antes de que termine
+ * 
+ * Debe llamarse justo antes de vTaskDelete(NULL): después el handle deja
+ * de ser válido y ya no se puede consultar.
+ */
+void huellaTareaTermina() {
+  TaskHandle_t yo = xTaskGetCurrentTaskHandle();
+  for (int i = 0; i < huellaNumTareas; i++) {
+    if (huellaTareas[i].handle == yo) {
+      huellaTareas[i].libreMin = uxTaskGetStackHighWaterMark(yo);
+      huellaTareas[i].handle = NULL;
+    }
+  }
+}
+
+/**
+ * @brief Registra el almacenamiento de una cola o buffer
+ */
+void huellaAnotarCola(const char *nombre, uint32_t bytes) {
+  if (huellaNumColas < HUELLA_MAX_COLAS) huellaColas[huellaNumColas++] = {nombre, bytes};
+}
+
+/**
+ * @brief Muestra la huella de memoria por serial y comprueba los presupuestos
+ * 
+ * Cada línea empieza por "HUELLA" para poder extraerla de la salida serie y
+ * compararla entre perfiles de compilación. Un presupuesto superado se
+ * marca con "HUELLA_EXCEDIDA" y, con HUELLA_ESTRICTA, detiene el equipo.
+ * 
+ * El desglose por módulo y símbolo (DHT, RTClib, printf con coma flotante)
+ * en IRAM, DRAM y flash no se puede obtener en ejecución: lo da
+ * herramientas/huella_map.py a partir del .map del enlazado, con su propio
+ * código de salida para fallar la compilación si se supera un presupuesto.
+ * 
+ * @return Número de presupuestos superados
+ */
+int huellaReportar() {
+  int excedidos = 0;
+  uint32_t pilaTotal = 0;
+  for (int i = 0; i < huellaNumTareas; i++) {
+    HuellaTarea &t = huellaTareas[i];
+    if (t.handle) t.libreMin = uxTaskGetStackHighWaterMark(t.handle);
+    pilaTotal += t.pila;
+    Serial.printf("HUELLA pila %s asignada %lu usada %lu libre %lu\n", t.nombre,
+                  (unsigned long)t.pila, (unsigned long)(t.pila - t.libreMin),
+                  (unsigned long)t.libreMin);
+    if (t.libreMin < HUELLA_PILA_LIBRE_MIN) {
+      Serial.printf("HUELLA_EXCEDIDA pila %s\n", t.nombre);
+      excedidos++;
+    }
+  }
+
+  uint32_t colasTotal = 0;
+  for (int i = 0; i < huellaNumColas; i++) {
+    colasTotal += huellaColas[i].bytes;
+    Serial.printf("HUELLA cola %s %lu\n", huellaColas[i].nombre, (unsigned long)huellaColas[i].bytes);
+  }
+
+  uint32_t data = &_data_end - &_data_start;
+  uint32_t bss = &_bss_end - &_bss_start;
+  Serial.printf("HUELLA total pilas %lu colas %lu data %lu bss %lu\n",
+                (unsigned long)pilaTotal, (unsigned long)colasTotal,
+                (unsigned long)data, (unsigned long)bss);
+  Serial.printf("HUELLA heap total %lu libre %lu minimo %lu bloque %lu\n",
+                (unsigned long)ESP.getHeapSize(), (unsigned long)ESP.getFreeHeap(),
+                (unsigned long)ESP.getMinFreeHeap(), (unsigned long)ESP.getMaxAllocHeap());
+  Serial.printf("HUELLA flash imagen %lu libre %lu\n",
+                (unsigned long)ESP.getSketchSize(), (unsigned long)ESP.getFreeSketchSpace());
+
+  if (data + bss > HUELLA_ESTATICA_MAX) {
+    Serial.println("HUELLA_EXCEDIDA estatica");
+    excedidos++;
+  }
+  if (ESP.getMinFreeHeap() < HUELLA_HEAP_LIBRE_MIN) {
+    Serial.println("HUELLA_EXCEDIDA heap");
+    excedidos++;
+  }
+  if (ESP.getSketchSize() > HUELLA_FLASH_MAX) {
+    Serial.println("HUELLA_EXCEDIDA flash");
+    excedidos++;
+  }
+  return excedidos;
+}
+
+// Latencia extremo a extremo: lectura de la muestra -> LED encendido
+volatile bool alarmaMuestraPendiente = false;  ///< Hay una muestra de alarma sin LED encendido aún
+volatile uint32_t alarmaMuestraUs = 0;         ///< Captura de la muestra más antigua sin atender
+volatile uint32_t loopbackFlancoUs = 0;        ///< Último flanco de subida visto en LOOPBACK_PIN
+HistogramaLatencia latenciaSoftware;           ///< Hasta digitalWrite(LED_PIN, HIGH)
+HistogramaLatencia latenciaLoopback;           ///< Hasta el flanco real medido en LOOPBACK_PIN
+
+// Latencia señal -> despertar de tareaAlarma (en us). No se usan ciclos de
+// CPU: el contador de ciclos es propio de cada núcleo y las tareas no están
+// fijadas, así que quien señaliza y quien despierta pueden estar en núcleos
+// distintos. micros() lee el temporizador común a ambos. Solo se mide la
+// señal que encuentra a tareaAlarma bloqueada: la que llega con el LED
+// encendido se acumula y su "latencia" incluiría el tiempo de encendido.
+volatile bool alarmaEsperando = false;    ///< tareaAlarma está bloqueada esperando señal
+volatile bool alarmaSenalMedible = false; ///< alarmaSenalUs corresponde a una espera real
+volatile uint32_t alarmaSenalUs = 0;      ///< Instante de la señal que despertará a tareaAlarma
+uint32_t alarmaAcumuladas = 0;            ///< Señales que no despertaron a tareaAlarma (fuera de la medida)
+uint32_t alarmaDespertarMin = UINT32_MAX; ///< Latencia mínima hasta despertar tareaAlarma
+uint32_t alarmaDespertarMax = 0;          ///< Latencia máxima hasta despertar tareaAlarma
+uint32_t alarmaDespertarSuma = 0;         ///< Suma de latencias para el promedio
+uint32_t alarmaDespertares = 0;           ///< Despertares medidos
+
+// Latencia del carril de alarmas
+uint32_t alarmaLatenciaMaxUs = 0;    ///< Latencia máxima evento -> escritura en el enlace
+uint32_t alarmaLatenciaSumaUs = 0;   ///< Suma de latencias para el promedio
+uint32_t alarmaEventosEnviados = 0;  ///< Eventos de alarma escritos en el enlace
+
+portMUX_TYPE secuenciaMux = portMUX_INITIALIZER_UNLOCKED;  ///< Protege los contadores de secuencia
+Preferences preferencias;                                  ///< Almacenamiento NVS (con nvsMutex)
+
+/**
+ * @brief Recupera los contadores de secuencia tras un arranque en frío
+ * 
+ * Tras un Deep Sleep los contadores siguen en memoria RTC. Tras una pérdida de
+ * alimentación se reanudan desde el límite reservado en NVS, de modo que nunca
+ * se repite un número aunque se pierdan hasta SECUENCIA_BLOQUE valores.
+ */
+void secuenciaIniciar() {
+  if (secuenciaValida) return;
+
+  xSemaphoreTake(nvsMutex, portMAX_DELAY);
+  preferencias.begin("secuencia", false);
+  secuenciaReservada = preferencias.getUInt("limite", 0);
+  secuenciaMuestra = secuenciaReservada;
+  secuenciaTrama = secuenciaReservada;
+  secuenciaReservada += SECUENCIA_BLOQUE;
+  preferencias.putUInt("limite", secuenciaReservada);
+  preferencias.end();
+  xSemaphoreGive(nvsMutex);
+  secuenciaValida = true;
+}
+
+/**
+ * @brief Obtiene el siguiente número de un contador de secuencia
+ * 
+ * Reserva un nuevo bloque en NVS cuando el contador alcanza el límite,
+ * así la flash se escribe una vez cada SECUENCIA_BLOQUE números. La llaman
+ * varias tareas (DHT11, LDR, CrearTrama), así que el commit en NVS se hace
+ * con nvsMutex y sus pilas deben tener sitio para él.
+ */
+uint32_t secuenciaSiguiente(uint32_t &contadorSecuencia) {
+  portENTER_CRITICAL(&secuenciaMux);
+  uint32_t valor = contadorSecuencia++;
+  bool reservar = contadorSecuencia >= secuenciaReservada;
+  if (reservar) secuenciaReservada += SECUENCIA_BLOQUE;
+  uint32_t limite = secuenciaReservada;
+  portEXIT_CRITICAL(&secuenciaMux);
+
+  if (reservar) {
+    xSemaphoreTake(nvsMutex, portMAX_DELAY);
+    preferencias.begin("secuencia", false);
+    // Otra tarea puede haber guardado ya un límite posterior
+    if (preferencias.getUInt("limite", 0) < limite) preferencias.putUInt("limite", limite);
+    preferencias.end();
+    xSemaphoreGive(nvsMutex);
+  }
+  return valor;
+}
+
+// Estado del WAL (protegido por walMutex)
+bool walDisponible = false;                                   ///< LittleFS montado correctamente
+uint8_t walGrupo[WAL_GRUPO_BYTES];                            ///< Registros pendientes de commit
+size_t walGrupoLen = 0;                                       ///< Bytes ocupados en walGrupo
+int walGrupoTramas = 0;                                       ///< Tramas en el grupo actual
+uint32_t walGrupoInicioMs = 0;                                ///< Instante de la primera trama del grupo
+uint32_t walDescartes = 0;                                    ///< Tramas que no cupieron en el WAL
+volatile bool backfillActivo = false;                         ///< Hay un volcado masivo en curso
+uint32_t tramasTruncadas = 0;                                 ///< Tramas descartadas por exceder TRAMA_MAX o no encajar en el esquema
+float cuantErrorObservado[CodificadorTrama::CAMPOS] = {0};    ///< Mayor error de cuantización visto por campo
+uint32_t cuantSaturadas[CodificadorTrama::CAMPOS] = {0};      ///< Valores fuera del rango de su campo
+volatile bool consolaConectada = CONSOLA_CONECTADA;           ///< Hay una salida que pide la representación de texto
+
+/**
+ * @brief Convierte un valor con decimales a centésimas saturando a int16_t
+ */
+int16_t centesimas(float valor) {
+  long c = lroundf(valor * 100);
+  return (int16_t)constrain(c, (long)INT16_MIN, (long)INT16_MAX);
+}
+
+/**
+ * @brief Empaqueta los datos de una trama sin formatearlos
+ */
+TramaBinaria tramaEmpaquetar(const RTCData &rtcData, float temperatura, float humedad, int luz) {
+  TramaBinaria b;
+  b.year = rtcData.year;
+  b.month = rtcData.month;
+  b.day = rtcData.day;
+  b.hour = rtcData.hour;
+  b.minute = rtcData.minute;
+  b.second = rtcData.second;
+  b.temperatura = centesimas(temperatura);
+  b.humedad = centesimas(humedad);
+  b.luz = (int16_t)constrain(luz, INT16_MIN, INT16_MAX);
+  return b;
+}
+
+/**
+ * @brief Empaqueta una trama en CodificadorTrama::BYTES bytes según EsquemaTrama
+ */
+void tramaCodificar(const TramaBinaria &b, uint8_t *salida) {
+  float valores[CodificadorTrama::CAMPOS];
+  valores[CAMPO_ANIO] = b.year;
+  valores[CAMPO_MES] = b.month;
+  valores[CAMPO_DIA] = b.day;
+  valores[CAMPO_HORA] = b.hour;
+  valores[CAMPO_MINUTO] = b.minute;
+  valores[CAMPO_SEGUNDO] = b.second;
+  valores[CAMPO_TEMPERATURA] = b.temperatura / 100.0f;
+  valores[CAMPO_HUMEDAD] = b.humedad / 100.0f;
+  valores[CAMPO_LUZ] = b.luz;
+  for (int i = CAMPO_TEMPERATURA; i <= CAMPO_LUZ; i++) {
+    if (valores[i] == CUANT_SIN_LECTURA) continue;
+    if (valores[i] < CodificadorTrama::reconstruir(i, CodificadorTrama::primero(i)) ||
+        valores[i] > CodificadorTrama::reconstruir(i, CodificadorTrama::maximo(i))) {
+      cuantSaturadas[i]++;
+      continue;
+    }
+    float error = fabsf(CodificadorTrama::reconstruir(i, CodificadorTrama::cuantizar(i, valores[i])) - valores[i]);
+    if (error > cuantErrorObservado[i]) cuantErrorObservado[i] = error;
+  }
+  CodificadorTrama::codificar(valores, salida);
+}
+
+/**
+ * @brief Muestra por serial la cuantización de cada medida y el error visto
+ * 
+ * Por canal: paso, rango, bits, cota del error de reconstrucción dentro del
+ * rango (paso / 2), mayor error observado y valores que saturaron. Al final,
+ * los bytes por trama frente a la TramaBinaria sin empaquetar y las tramas que
+ * no se pudieron pasar a texto (tramasTruncadas), que no llegan a la consola.
+ */
+void cuantizacionReportar() {
+  static const char *const nombres[] = {"temperatura", "humedad", "luz"};
+  for (int i = CAMPO_TEMPERATURA; i <= CAMPO_LUZ; i++) {
+    const CampoEsquema &campo = EsquemaTrama::campos[i];
+    Serial.printf("CUANT %s paso %g rango %g..%g bits %u error_max %g error_obs %g saturadas %lu\n",
+                  nombres[i - CAMPO_TEMPERATURA], campo.escala,
+                  CodificadorTrama::reconstruir(i, CodificadorTrama::primero(i)),
+                  CodificadorTrama::reconstruir(i, CodificadorTrama::maximo(i)),
+                  campo.bits, CodificadorTrama::errorMaximo(i), cuantErrorObservado[i],
+                  (unsigned long)cuantSaturadas[i]);
+  }
+  Serial.printf("CUANT trama %d bytes (sin empaquetar %u) sin_texto %lu\n",
+                CodificadorTrama::BYTES, (unsigned)sizeof(TramaBinaria),
+                (unsigned long)tramasTruncadas);
+}
+
+/**
+ * @brief Desempaqueta una trama codificada con el esquema de Codificador
+ */
+template <class Codificador>
+TramaBinaria tramaDecodificarCon(const uint8_t *entrada) {
+  float valores[Codificador::CAMPOS];
+  Codificador::decodificar(entrada, valores);
+  TramaBinaria b;
+  b.year = lroundf(valores[CAMPO_ANIO]);
+  b.month = lroundf(valores[CAMPO_MES]);
+  b.day = lroundf(valores[CAMPO_DIA]);
+  b.hour = lroundf(valores[CAMPO_HORA]);
+  b.minute = lroundf(valores[CAMPO_MINUTO]);
+  b.second = lroundf(valores[CAMPO_SEGUNDO]);
+  b.temperatura = centesimas(valores[CAMPO_TEMPERATURA]);
+  b.humedad = centesimas(valores[CAMPO_HUMEDAD]);
+  b.luz = lroundf(valores[CAMPO_LUZ]);
+  return b;
+}
+
+/**
+ * @brief Desempaqueta una trama codificada con tramaCodificar
+ */
+TramaBinaria tramaDecodificar(const uint8_t *entrada) {
+  return tramaDecodificarCon<CodificadorTrama>(entrada);
+}
+
+/**
+ * @brief Indica si un tipo de registro lleva una trama sin formatear
+ */
+bool tramaEsBinaria(uint8_t tipo) {
+  return tipo == WAL_REG_BINARIO || tipo == WAL_REG_EMPAQUETADO || tipo == WAL_REG_EMPAQUETADO_V2;
+}
+
+/**
+ * @brief Obtiene la TramaBinaria de un mensaje binario o empaquetado
+ * 
+ * Devuelve false si el mensaje es de texto o su longitud no corresponde al tipo.
+ */
+bool tramaExtraer(const TramaLog &trama, uint16_t len, TramaBinaria &b) {
+  if (trama.tipo == WAL_REG_EMPAQUETADO_V2 && len == CodificadorTrama::BYTES) {
+    b = tramaDecodificar((const uint8_t *)trama.texto);
+    return true;
+  }
+  if (trama.tipo == WAL_REG_EMPAQUETADO && len == CodificadorTramaV1::BYTES) {
+    b = tramaDecodificarCon<CodificadorTramaV1>((const uint8_t *)trama.texto);
+    return true;
+  }
+  if (trama.tipo == WAL_REG_BINARIO && len == sizeof(TramaBinaria)) {
+    memcpy(&b, trama.texto, sizeof(b));
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Formatea una trama de texto
+ * 
+ * Devuelve lo mismo que snprintf: la longitud que tendría la trama completa,
+ * que puede ser mayor o igual que tam si no cabe.
+ */
+int formatearTrama(char *trama, size_t tam, uint32_t secuencia, const TramaBinaria &b) {
+  return snprintf(trama, tam, 
+                  "#%lu %02d/%02d/%04d %02d:%02d:%02d, Temp: %.*f C, Hum: %.*f%%, Luz: %d",
+                  (unsigned long)secuencia,
+                  b.day, b.month, b.year,
+                  b.hour, b.minute, b.second,
+                  decimalesPara(CUANT_TEMPERATURA_PASO), b.temperatura / 100.0f,
+                  decimalesPara(CUANT_HUMEDAD_PASO), b.humedad / 100.0f, b.luz);
+}
+
+/**
+ * @brief Deja en trama.texto la representación de texto de una trama
+ * 
+ * len es a la entrada la longitud del contenido y a la salida la del texto.
+ * Las tramas binarias se formatean aquí, en la salida que necesita el texto,
+ * con los decimales que permite el paso de cada canal. Devuelve false (y lo
+ * cuenta en tramasTruncadas) si el texto no cabe en TRAMA_MAX o si una trama
+ * empaquetada no tiene la longitud del esquema actual (p. ej. registros de
+ * un firmware con otra cuantización); la trama nunca se emite cortada.
+ */
+bool tramaComoTexto(TramaLog &trama, uint16_t &len) {
+  TramaBinaria b;
+  if (!tramaExtraer(trama, len, b)) {
+    if (tramaEsBinaria(trama.tipo)) {
+      tramasTruncadas++;
+      return false;
+    }
+    trama.texto[len] = '\0';
+    return true;
+  }
+  int n = formatearTrama(trama.texto, sizeof(trama.texto), trama.secuencia, b);
+  if (n < 0 || n >= (int)sizeof(trama.texto)) {
+    tramasTruncadas++;
+    return false;
+  }
+  trama.tipo = WAL_REG_TRAMA;
+  len = n;
+  return true;
+}
+
+/**
+ * @enum Representacion
+ * @brief Representación de las tramas que necesita una salida
+ */
+enum Representacion : uint8_t {
+  REPRESENTACION_TEXTO,    ///< Se formatean antes de entregarlas (tramaComoTexto)
+  REPRESENTACION_BINARIA,  ///< Se entregan como TramaBinaria, sin formatear
+};
+
+/**
+ * @struct Sink
+ * @brief Salida registrada sobre el flujo común de tramas
+ * 
+ * Cada salida tiene su propio message buffer (su presupuesto de memoria), su
+ * ritmo y su tamaño de lote, así una salida lenta solo pierde sus propias
+ * tramas. Las salidas con escribir se atienden con tareaSink; las que tienen
+ * una lógica propia (la consola serie, con ARQ) leen su buffer desde su tarea.
+ * 
+ * Métricas: recibidas y descartadas las actualiza walCommit (con walMutex);
+ * sinFormato, entregadas, bytes y lotes solo la tarea de la salida.
+ */
+struct Sink {
+  const char *nombre;                ///< Nombre para informes y para su tarea
+  Representacion representacion;     ///< Representación que necesita
+  uint32_t periodoMs;                ///< Intervalo mínimo entre lotes
+  uint8_t lote;                      ///< Tramas máximas por lote
+  size_t bufferBytes;                ///< Capacidad de su message buffer
+  void (*escribir)(const TramaLog &trama, uint16_t len);  ///< Entrega una trama (NULL: tarea propia)
+  void (*finLote)();                 ///< Llamada tras cada lote no vacío (opcional)
+  volatile bool *conectada;          ///< NULL: siempre conectada; si no, no recibe tramas mientras sea false
+  MessageBufferHandle_t buffer;      ///< Tramas pendientes de esta salida
+  uint32_t recibidas;                ///< Tramas publicadas mientras estaba conectada
+  uint32_t descartadas;              ///< Tramas que no cupieron en su buffer
+  uint32_t sinFormato;               ///< Tramas que no pudieron representarse
+  uint32_t entregadas;               ///< Tramas entregadas
+  uint32_t bytes;                    ///< Bytes entregados
+  uint32_t lotes;                    ///< Lotes no vacíos
+  TaskHandle_t tarea;                ///< Tarea de la salida (NULL si no tiene escribir)
+  volatile bool vaciada;             ///< La tarea terminó el vaciado pedido por sinksVaciar
 };
 
+Sink sinks[SINK_MAX];  ///< Salidas registradas
+int numSinks = 0;      ///< Entradas usadas de sinks
+Sink *sinkSerie;       ///< Consola serie (tareaMostrarTrama)
+Sink *sinkDiag;        ///< Salida de diagnóstico (NULL si no está registrada)
+
+/**
+ * @brief Publica una trama en el buffer de cada salida conectada
+ * 
+ * No bloquea nunca: si el buffer de una salida está lleno, la trama se
+ * cuenta como descartada solo para esa salida.
+ */
+void sinksPublicar(const TramaLog &trama, size_t bytes) {
+  for (int i = 0; i < numSinks; i++) {
+    Sink &sink = sinks[i];
+    if (sink.conectada && !*sink.conectada) continue;
+    sink.recibidas++;
+    if (xMessageBufferSend(sink.buffer, &trama, bytes, 0) != bytes) sink.descartadas++;
+  }
+}
+
+/**
+ * @brief Entrega un lote (como máximo lote tramas) y lo cierra con finLote
+ * 
+ * Devuelve true si el lote se llenó (puede quedar más en el buffer).
+ */
+bool sinkEntregarLote(Sink &sink) {
+  TramaLog trama;
+  int n = 0;
+  while (n < sink.lote) {
+    size_t recibidos = xMessageBufferReceive(sink.buffer, &trama, sizeof(trama), 0);
+    if (recibidos == 0) break;
+    uint16_t len = recibidos - TRAMA_CABECERA_MSG;
+    if (sink.representacion == REPRESENTACION_TEXTO && !tramaComoTexto(trama, len)) {
+      sink.sinFormato++;
+      continue;
+    }
+    sink.escribir(trama, len);
+    sink.entregadas++;
+    sink.bytes += len;
+    n++;
+  }
+  if (n > 0) {
+    sink.lotes++;
+    if (sink.finLote) sink.finLote();
+  }
+  return n == sink.lote;
+}
+
+/**
+ * @brief Tarea genérica de una salida registrada
+ * 
+ * Cada periodoMs entrega como máximo lote tramas de su buffer, en la
+ * representación que pidió la salida, y cierra el lote con finLote. Si
+ * sinksVaciar la notifica antes, entrega por lotes todo lo pendiente.
+ */
+void tareaSink(void *pvParameters) {
+  Sink &sink = *(Sink *)pvParameters;
+
+  while (1) {
+    bool vaciar = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sink.periodoMs)) > 0;
+    while (sinkEntregarLote(sink) && vaciar) {}
+    if (vaciar) sink.vaciada = true;
+  }
+}
+
+/**
+ * @brief Vacía todas las salidas con tarea propia antes de dormir
+ * 
+ * Con periodos más largos que el tiempo despierto (el diagnóstico es de
+ * 60 s y el equipo duerme a los ~10 s) una salida nunca llegaría a
+ * entregar un lote. Espera como mucho esperaMs a que terminen.
+ */
+void sinksVaciar(uint32_t esperaMs) {
+  for (int i = 0; i < numSinks; i++) {
+    if (sinks[i].tarea == NULL) continue;
+    sinks[i].vaciada = false;
+    xTaskNotifyGive(sinks[i].tarea);
+  }
+  uint32_t inicio = millis();
+  for (int i = 0; i < numSinks; i++) {
+    while (sinks[i].tarea != NULL && !sinks[i].vaciada && millis() - inicio < esperaMs) {
+      vTaskDelay(pdMS_TO_TICKS(10));
+    }
+  }
+}
+
+/**
+ * @brief Registra una salida y crea su buffer (y su tarea si tiene escribir)
+ * 
+ * Debe llamarse en setup, antes de crear las tareas que publican tramas.
+ * Devuelve NULL si no quedan entradas libres o no hay memoria para el buffer.
+ */
+Sink *sinkRegistrar(const char *nombre, Representacion representacion, uint32_t periodoMs,
+                    uint8_t lote, size_t bufferBytes,
+                    void (*escribir)(const TramaLog &, uint16_t) = NULL,
+                    void (*finLote)() = NULL, volatile bool *conectada = NULL) {
+  if (numSinks >= SINK_MAX) return NULL;
+  Sink &sink = sinks[numSinks];
+  sink = {nombre, representacion, periodoMs, lote, bufferBytes, escribir, finLote, conectada,
+          NULL, 0, 0, 0, 0, 0, 0, NULL, false};
+  sink.buffer = xMessageBufferCreate(sink.bufferBytes);
+  if (sink.buffer == NULL) return NULL;
+  huellaAnotarCola(sink.nombre, sink.bufferBytes);
+  numSinks++;
+  if (sink.escribir) crearTarea(tareaSink, sink.nombre, SINK_PILA, &sink, 1, &sink.tarea);
+  return &sink;
+}
+
+/**
+ * @brief Muestra por serial el caudal y las pérdidas de cada salida
+ */
+void sinksReportar() {
+  for (int i = 0; i < numSinks; i++) {
+    const Sink &sink = sinks[i];
+    Serial.printf("SINK %s recibidas %lu entregadas %lu descartadas %lu sin_formato %lu "
+                  "bytes %lu lotes %lu\n",
+                  sink.nombre, (unsigned long)sink.recibidas, (unsigned long)sink.entregadas,
+                  (unsigned long)sink.descartadas, (unsigned long)sink.sinFormato,
+                  (unsigned long)sink.bytes,
+                  (unsigned long)sink.lotes);
+  }
+}
+
+// Salida de diagnóstico: resumen por lote, sin formatear cada trama
+uint32_t diagPrimera = 0;                 ///< Secuencia de la primera trama del lote
+uint32_t diagUltima = 0;                  ///< Secuencia de la última trama del lote
+int diagTramas = 0;                       ///< Tramas del lote actual
+int16_t diagTempMin = INT16_MAX;          ///< Temperatura mínima del lote (centésimas)
+int16_t diagTempMax = INT16_MIN;          ///< Temperatura máxima del lote (centésimas)
+
+/**
+ * @brief Acumula una trama en el resumen de diagnóstico
+ */
+void diagEscribir(const TramaLog &trama, uint16_t len) {
+  TramaBinaria b;
+  if (!tramaExtraer(trama, len, b)) return;
+  if (diagTramas == 0) diagPrimera = trama.secuencia;
+  diagUltima = trama.secuencia;
+  diagTramas++;
+  diagTempMin = min(diagTempMin, b.temperatura);
+  diagTempMax = max(diagTempMax, b.temperatura);
+}
+
+/**
+ * @brief Emite el resumen del lote de diagnóstico
+ * 
+ * Durante un backfill no se escribe: el lote sigue acumulando y se resume
+ * entero al terminar el volcado.
+ */
+void diagFinLote() {
+  if (diagTramas == 0 || backfillActivo) return;
+  xSemaphoreTake(enlaceMutex, portMAX_DELAY);
+  Serial.printf("DIAG #%lu-#%lu n %d temp %.2f..%.2f C\n",
+                (unsigned long)diagPrimera, (unsigned long)diagUltima, diagTramas,
+                diagTempMin / 100.0f, diagTempMax / 100.0f);
+  xSemaphoreGive(enlaceMutex);
+  diagTramas = 0;
+  diagTempMin = INT16_MAX;
+  diagTempMax = INT16_MIN;
+}
+
+/**
+ * @brief Escribe en flash el grupo de tramas pendiente (group commit)
+ * 
+ * Esta función:
+ * 1. Añade todos los registros del grupo al final del WAL en una sola escritura
+ * 2. Fuerza el vaciado a flash con flush()
+ * 3. Solo después de esto las tramas se consideran durables y se publican en
+ *    las salidas registradas (sinksPublicar)
+ * 
+ * Nota:
+ * - Debe llamarse con walMutex tomado, por eso la publicación no bloquea
+ * - Una trama durable que no cabe en tramaBuffer (consola serie) se
+ *   reproduce en el próximo arranque
+ * - Si el WAL no está disponible las tramas se envían igualmente, sin durabilidad
+ */
+void walCommit() {
+  if (walGrupoTramas == 0) return;
+
+  uint32_t base = UINT32_MAX;
+  if (walDisponible) {
+    File f = LittleFS.open(WAL_RUTA, FILE_APPEND);
+    if (f && f.size() + walGrupoLen <= WAL_MAX_BYTES) {
+      base = f.size();
+      f.write(walGrupo, walGrupoLen);
+      f.flush();
+    } else {
+      walDescartes += walGrupoTramas;
+    }
+    if (f) f.close();
+  }
+
+  // Reenviar las tramas ya durables a la tarea de salida
+  size_t pos = 0;
+  while (pos < walGrupoLen) {
+    TramaLog trama;
+    uint8_t len = walGrupo[pos + 1];
+    trama.inicio = (base == UINT32_MAX) ? UINT32_MAX : base + pos;
+    trama.fin = (base == UINT32_MAX) ? UINT32_MAX : base + pos + WAL_CABECERA + len;
+    trama.tipo = walGrupo[pos];
+    memcpy(&trama.secuencia, &walGrupo[pos + 2], sizeof(trama.secuencia));
+    memcpy(trama.texto, &walGrupo[pos + WAL_CABECERA], len);
+    sinksPublicar(trama, TRAMA_CABECERA_MSG + len);
+    pos += WAL_CABECERA + len;
+  }
+
+  walGrupoLen = 0;
+  walGrupoTramas = 0;
+}
+
+/**
+ * @brief Añade una trama al grupo actual del WAL
+ * 
+ * El grupo se escribe en flash cuando alcanza WAL_GRUPO_MAX_TRAMAS tramas o
+ * WAL_GRUPO_BYTES bytes, o cuando su primera trama supera WAL_VENTANA_MS de
+ * antigüedad.
+ */
+void walAgregar(uint32_t secuencia, const TramaBinaria &trama) {
+  size_t len = CodificadorTrama::BYTES;
+
+  xSemaphoreTake(walMutex, portMAX_DELAY);
+  if (walGrupoLen + WAL_CABECERA + len > WAL_GRUPO_BYTES) walCommit();
+  if (walGrupoTramas == 0) walGrupoInicioMs = millis();
+  walGrupo[walGrupoLen] = WAL_REG_EMPAQUETADO_V2;
+  walGrupo[walGrupoLen + 1] = (uint8_t)len;
+  memcpy(&walGrupo[walGrupoLen + 2], &secuencia, sizeof(secuencia));
+  tramaCodificar(trama, &walGrupo[walGrupoLen + WAL_CABECERA]);
+  walGrupoLen += WAL_CABECERA + len;
+  walGrupoTramas++;
+
+  if (walGrupoTramas >= WAL_GRUPO_MAX_TRAMAS) walCommit();
+  xSemaphoreGive(walMutex);
+}
+
+/**
+ * @brief Hace commit del grupo si su ventana de durabilidad ha vencido
+ */
+void walCommitSiVence() {
+  xSemaphoreTake(walMutex, portMAX_DELAY);
+  if (walGrupoTramas > 0 && millis() - walGrupoInicioMs >= WAL_VENTANA_MS) {
+    walCommit();
+  }
+  xSemaphoreGive(walMutex);
+}
+
+/**
+ * @brief Avanza el offset de entrega y compacta el WAL cuando todo se entregó
+ * 
+ * El offset de entrega solo avanza de forma contigua: si hay registros anteriores
+ * sin entregar, los posteriores se reenviarán en la próxima reproducción.
+ */
+void walAvanzarEntregado(uint32_t inicio, uint32_t fin) {
+  xSemaphoreTake(walMutex, portMAX_DELAY);
+  if (walEntregado == inicio) {
+    walEntregado = fin;
+    File f = LittleFS.open(WAL_RUTA, FILE_READ);
+    bool completo = f && f.size() == walEntregado;
+    if (f) f.close();
+    if (completo) {
+      LittleFS.remove(WAL_RUTA);
+      walEntregado = 0;
+    }
+  }
+  xSemaphoreGive(walMutex);
+}
+
+/**
+ * @brief Marca un registro como entregado si llegó a escribirse en el WAL
+ */
+void walAvanzarSiRegistrada(uint32_t inicio, uint32_t fin) {
+  if (inicio == UINT32_MAX) return;
+  walAvanzarEntregado(inicio, fin);
+}
+
+/**
+ * @brief Marca una trama como entregada en el WAL
+ */
+void walMarcarEntregada(const TramaLog &trama) {
+  walAvanzarSiRegistrada(trama.inicio, trama.fin);
+}
+
+/**
+ * @brief Devuelve el tamaño actual del WAL en bytes (0 si no existe)
+ */
+uint32_t walTamano() {
+  File f = LittleFS.open(WAL_RUTA, FILE_READ);
+  uint32_t tam = f ? f.size() : 0;
+  if (f) f.close();
+  return tam;
+}
+
+/**
+ * @brief Reproduce como texto las tramas durables que no llegaron a emitirse
+ * 
+ * Esta función:
+ * 1. Abre el WAL y se posiciona en walEntregado
+ * 2. Emite por serial cada trama registrada hasta el offset hasta
+ *    (las binarias se formatean al emitirlas)
+ * 3. Marca el rango como entregado (el WAL se vacía si no queda nada más)
+ * 
+ * Nota:
+ * - Tras una pérdida de alimentación walEntregado vuelve a 0 y el WAL se
+ *   reproduce completo (entrega al menos una vez)
+ * - Sin consola de texto no se reproduce nada: las tramas siguen pendientes
+ *   para el backfill o para cuando se conecte una consola
+ */
+void walReproducir(uint32_t hasta) {
+  if (!consolaConectada) return;
+
+  File f = LittleFS.open(WAL_RUTA, FILE_READ);
+  if (!f) {
+    walEntregado = 0;
+    return;
+  }
+
+  if (walEntregado > f.size()) walEntregado = 0;
+  uint32_t desde = walEntregado;
+  f.seek(desde);
+
+  uint8_t cabecera[WAL_CABECERA];
+  TramaLog trama;
+  int reproducidas = 0;
+  while (f.position() < hasta && f.read(cabecera, 2) == 2) {
+    uint16_t len = cabecera[1];
+    bool conSecuencia = cabecera[0] == WAL_REG_TRAMA || tramaEsBinaria(cabecera[0]);
+    if (conSecuencia && f.read(&cabecera[2], 4) != 4) break;
+    if (f.read((uint8_t *)trama.texto, len) != len) break;
+    trama.tipo = cabecera[0];
+    memcpy(&trama.secuencia, &cabecera[2], sizeof(trama.secuencia));
+    if ((conSecuencia || cabecera[0] == WAL_REG_TEXTO) && tramaComoTexto(trama, len)) {
+      Serial.println(trama.texto);
+      reproducidas++;
+    }
+  }
+  f.close();
+
+  walAvanzarEntregado(desde, hasta);
+  Serial.print("WAL: tramas reproducidas: ");
+  Serial.println(reproducidas);
+}
+
+/**
+ * @brief Calcula el CRC-16/CCITT de un bloque de datos
+ */
+uint16_t crc16(const uint8_t *datos, size_t len, uint16_t crc = 0xFFFF) {
+  for (size_t i = 0; i < len; i++) {
+    crc ^= (uint16_t)datos[i] << 8;
+    for (int b = 0; b < 8; b++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+/**
+ * @brief Envía un bloque crudo del WAL por el enlace serie
+ * 
+ * Formato: magia (0xA5 0x5A), índice (uint16), longitud (uint16),
+ * datos y CRC-16 de todo lo anterior. Un bloque de longitud 0 marca el final.
+ * 
+ * Los datos ya deben estar en bloque a partir de BACKFILL_CABECERA, con
+ * BACKFILL_COLA bytes libres detrás: la cabecera y el CRC se completan en el
+ * mismo buffer y el bloque sale con una sola escritura, sin huecos en los que
+ * pueda colarse otro escritor.
+ */
+void backfillEnviarBloque(uint16_t indice, uint8_t *bloque, uint16_t len) {
+  bloque[0] = 0xA5;
+  bloque[1] = 0x5A;
+  bloque[2] = indice & 0xFF;
+  bloque[3] = indice >> 8;
+  bloque[4] = len & 0xFF;
+  bloque[5] = len >> 8;
+  uint16_t crc = crc16(bloque, BACKFILL_CABECERA + len);
+  bloque[BACKFILL_CABECERA + len] = crc & 0xFF;
+  bloque[BACKFILL_CABECERA + len + 1] = crc >> 8;
+  Serial.write(bloque, BACKFILL_CABECERA + len + BACKFILL_COLA);
+}
+
+/**
+ * @brief Escribe en el enlace los eventos pendientes del carril de alarmas
+ * 
+ * Los carriles del enlace se atienden con prioridad estricta:
+ * 1. Alarmas (alarmaQueue)
+ * 2. Confirmaciones y retransmisiones ARQ
+ * 3. Tramas nuevas (tramaBuffer)
+ * 4. Bloques de backfill
+ * 
+ * Tanto tareaMostrarTrama como tareaBackfill llaman a esta función antes de
+ * cada escritura, y tareaBackfill también mientras espera la aceptación y las
+ * confirmaciones del host (leerLineaEnlace), así una alarma espera como mucho
+ * a que termine la trama o el bloque que ya se está escribiendo, no a que
+ * venza un timeout del protocolo. La latencia se acumula en
+ * alarmaLatenciaMaxUs / alarmaLatenciaSumaUs.
+ */
+void enlaceAtenderAlarmas(TickType_t espera) {
+  EventoAlarma evento;
+  while (xQueueReceive(alarmaQueue, &evento, espera) == pdPASS) {
+    xSemaphoreTake(enlaceMutex, portMAX_DELAY);
+    Serial.printf("!ALARMA reglas=0x%02X muestra=#%lu\n",
+                  evento.reglas, (unsigned long)evento.muestra);
+    xSemaphoreGive(enlaceMutex);
+
+    uint32_t latencia = micros() - evento.creadoUs;
+    if (latencia > alarmaLatenciaMaxUs) alarmaLatenciaMaxUs = latencia;
+    alarmaLatenciaSumaUs += latencia;
+    alarmaEventosEnviados++;
+    espera = 0;
+  }
+}
+
+volatile TaskHandle_t enlaceLector = NULL;  ///< Tarea bloqueada en leerLineaEnlace
+
+/**
+ * @brief Despierta a la tarea que espera datos del enlace (Serial.onReceive)
+ * 
+ * Se ejecuta en la tarea de eventos de la UART, no en una ISR.
+ */
+void enlaceDatosRecibidos() {
+  TaskHandle_t lector = enlaceLector;
+  if (lector != NULL) xTaskNotifyGive(lector);
+}
+
+/**
+ * @brief Lee una línea de comando del enlace serie
+ * 
+ * Devuelve true si se recibió una línea completa antes de timeoutMs
+ * (portMAX_DELAY: sin límite). Los caracteres se acumulan en linea hasta
+ * '\n' (se descarta '\r'). Sin datos, la tarea se bloquea hasta que
+ * enlaceDatosRecibidos la notifica, sin sondear la UART en cada tick.
+ * Con atenderAlarmas, la espera se hace en cambio sobre el carril de
+ * alarmas en pasos de 1 ms (la usa tareaBackfill, que es el único escritor
+ * del enlace mientras espera al host y solo durante el volcado).
+ */
+bool leerLineaEnlace(char *linea, size_t tam, uint32_t timeoutMs, bool atenderAlarmas = false) {
+  size_t n = 0;
+  uint32_t inicio = millis();
+  enlaceLector = xTaskGetCurrentTaskHandle();
+  while (timeoutMs == portMAX_DELAY || millis() - inicio < timeoutMs) {
+    while (Serial.available() > 0) {
+      char c = Serial.read();
+      if (c == '\r') continue;
+      if (c == '\n') {
+        linea[n] = '\0';
+        enlaceLector = NULL;
+        return true;
+      }
+      if (n < tam - 1) linea[n++] = c;
+    }
+    if (atenderAlarmas) {
+      enlaceAtenderAlarmas(pdMS_TO_TICKS(1));
+    } else if (timeoutMs == portMAX_DELAY) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    } else {
+      uint32_t transcurrido = millis() - inicio;
+      if (transcurrido < timeoutMs) ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeoutMs - transcurrido) + 1);
+    }
+  }
+  enlaceLector = NULL;
+  return false;
+}
+
+/**
+ * @brief Tarea de volcado masivo (backfill) del WAL pendiente
+ * 
+ * Esta tarea:
+ * 1. Anuncia por serial "BACKFILL <bytes>" y espera la aceptación "B" del host
+ * 2. Envía el rango pendiente del WAL en bloques crudos de BACKFILL_BLOQUE bytes,
+ *    sin pausa entre tramas, con una ventana de BACKFILL_VENTANA bloques sin confirmar
+ *    (representación binaria: el host decodifica los registros WAL_REG_EMPAQUETADO_V2
+ *    con EsquemaTrama y los WAL_REG_EMPAQUETADO con EsquemaTramaV1, ambos de
+ *    esquema_trama.h)
+ * 3. El host confirma con "K<n>" (acumulativo); si vence el timeout se reenvía
+ *    desde el primer bloque sin confirmar (go-back-N)
+ * 4. Al completarse marca el rango como entregado
+ * 
+ * Si el host no acepta, el rango se reproduce como texto por serial si hay
+ * consola de texto.
+ * Mientras la tarea está activa, tareaMostrarTrama y el Deep Sleep esperan y
+ * el resto de tareas no escribe texto en la consola (cargaPermiteConsola y
+ * backfillActivo), para no romper el flujo binario que decodifica el host.
+ * Los eventos de alarma los atiende esta tarea: entre bloques y durante las
+ * esperas al host.
+ */
+void tareaBackfill(void *pvParameters) {
+  uint32_t hasta = (uint32_t)(uintptr_t)pvParameters;
+  uint32_t desde = walEntregado;
+  uint16_t nBloques = (hasta - desde + BACKFILL_BLOQUE - 1) / BACKFILL_BLOQUE;
+  char linea[16];
+
+  xSemaphoreTake(enlaceMutex, portMAX_DELAY);
+  Serial.printf("BACKFILL %u\n", (unsigned)(hasta - desde));
+  xSemaphoreGive(enlaceMutex);
+  if (!leerLineaEnlace(linea, sizeof(linea), BACKFILL_ESPERA_MS, true) || linea[0] != 'B') {
+    walReproducir(hasta);
+    huellaTareaTermina();
+    backfillActivo = false;
+    vTaskDelete(NULL);
+  }
+
+  File f = LittleFS.open(WAL_RUTA, FILE_READ);
+  uint8_t bloque[BACKFILL_CABECERA + BACKFILL_BLOQUE + BACKFILL_COLA];
+  uint16_t base = 0;
+  uint16_t siguiente = 0;
+  int reintentos = 0;
+
+  while (f && base < nBloques && reintentos < BACKFILL_REINTENTOS) {
+    // Llenar la ventana
+    while (siguiente < nBloques && siguiente < base + BACKFILL_VENTANA) {
+      uint32_t offset = desde + (uint32_t)siguiente * BACKFILL_BLOQUE;
+      uint16_t len = min((uint32_t)BACKFILL_BLOQUE, hasta - offset);
+      f.seek(offset);
+      f.read(&bloque[BACKFILL_CABECERA], len);
+      enlaceAtenderAlarmas(0);
+      xSemaphoreTake(enlaceMutex, portMAX_DELAY);
+      backfillEnviarBloque(siguiente, bloque, len);
+      xSemaphoreGive(enlaceMutex);
+      siguiente++;
+    }
+
+    // Esperar confirmaciones
+    if (leerLineaEnlace(linea, sizeof(linea), BACKFILL_TIMEOUT_MS, true) && linea[0] == 'K') {
+      uint16_t confirmado = atoi(&linea[1]);
+      if (confirmado >= base && confirmado < nBloques) {
+        base = confirmado + 1;
+        reintentos = 0;
+      }
+    } else {
+      siguiente = base;
+      reintentos++;
+    }
+  }
+  if (f) f.close();
+
+  xSemaphoreTake(enlaceMutex, portMAX_DELAY);
+  if (base == nBloques) {
+    backfillEnviarBloque(nBloques, bloque, 0);
+  } else {
+    Serial.println("BACKFILL abortado, se reintentará en el próximo arranque");
+  }
+  xSemaphoreGive(enlaceMutex);
+  if (base == nBloques) walAvanzarEntregado(desde, hasta);
+
+  huellaTareaTermina();
+  backfillActivo = false;
+  vTaskDelete(NULL);
+}
+
+/**
+ * @struct TareaMuestreo
+ * @brief Tarea periódica registrada en el coordinador de muestreo
+ */
+struct TareaMuestreo {
+  TaskHandle_t tarea;   ///< Tarea a despertar
+  uint32_t periodoMs;   ///< Periodo solicitado (puede cambiar en cada espera)
+};
+
+// Estado del coordinador de muestreo (protegido por muestreoMux)
+portMUX_TYPE muestreoMux = portMUX_INITIALIZER_UNLOCKED;   ///< Protege registro e histograma
+TareaMuestreo muestreoTareas[MUESTREO_MAX_TAREAS];         ///< Tareas registradas
+int muestreoNumTareas = 0;                                 ///< Entradas usadas de muestreoTareas
+uint32_t muestreoUltimoDespertarUs = 0;                    ///< Último despertar de cualquier tarea periódica
+uint32_t muestreoHistograma[MUESTREO_CUBETAS];             ///< Huecos entre despertares: cubeta i = [2^(i-1), 2^i) ms
+
+/**
+ * @brief Anota el despertar de una tarea periódica en el histograma de huecos
+ * 
+ * Los despertares separados menos de MUESTREO_VENTANA_US pertenecen a la
+ * misma ventana de trabajo; el resto abre un nuevo hueco cuya duración se
+ * acumula en una cubeta logarítmica.
+ * 
+ * Solo ve las tareas que esperan con muestreoEsperar: el lector del enlace,
+ * las esperas de 100 ms de tareaMostrar y tareaMostrarTrama o ControlCarga
+ * también despiertan a la CPU y no cuentan. El histograma mide cuánto
+ * agrupa el coordinador sus propias tareas, no la inactividad real de la
+ * CPU (esa la da cpu_libre en la línea CARGA, con CARGA_CONTROL_ACTIVO).
+ */
+void muestreoAnotarDespertar() {
+  uint32_t ahora = micros();
+  portENTER_CRITICAL(&muestreoMux);
+  uint32_t inactivo = ahora - muestreoUltimoDespertarUs;
+  if (muestreoUltimoDespertarUs != 0 && inactivo >= MUESTREO_VENTANA_US) {
+    muestreoHistograma[cubetaLog2(inactivo / 1000, MUESTREO_CUBETAS)]++;
+  }
+  muestreoUltimoDespertarUs = ahora;
+  portEXIT_CRITICAL(&muestreoMux);
+}
+
+/**
+ * @brief Espera al siguiente instante de muestreo de la tarea que llama
+ * 
+ * Con MUESTREO_ALINEADO la tarea se registra (o actualiza su periodo) en el
+ * coordinador y se bloquea hasta que este la notifica en una ranura de la
+ * rejilla común. Sin él, equivale al vTaskDelay(periodoMs) original.
+ */
+void muestreoEsperar(uint32_t periodoMs) {
+#if MUESTREO_ALINEADO
+  TaskHandle_t yo = xTaskGetCurrentTaskHandle();
+  bool nueva = false;
+  portENTER_CRITICAL(&muestreoMux);
+  int i = 0;
+  while (i < muestreoNumTareas && muestreoTareas[i].tarea != yo) i++;
+  if (i == muestreoNumTareas && i < MUESTREO_MAX_TAREAS) {
+    muestreoTareas[i].tarea = yo;
+    muestreoNumTareas++;
+    nueva = true;
+  }
+  if (i < MUESTREO_MAX_TAREAS) muestreoTareas[i].periodoMs = periodoMs;
+  portEXIT_CRITICAL(&muestreoMux);
+
+  uint32_t ranuras = (periodoMs + MUESTREO_BASE_MS / 2) / MUESTREO_BASE_MS;
+  int32_t desvio = (int32_t)(max((uint32_t)1, ranuras) * MUESTREO_BASE_MS) - (int32_t)periodoMs;
+  if (nueva && abs(desvio) > MUESTREO_HOLGURA_MS) {
+    Serial.printf("Muestreo: %s pide %lu ms, fuera de la holgura de la rejilla\n",
+                  pcTaskGetName(yo), (unsigned long)periodoMs);
+  }
+
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+#else
+  vTaskDelay(pdMS_TO_TICKS(periodoMs));
+#endif
+  muestreoAnotarDespertar();
+}
+
+/**
+ * @brief Tarea coordinadora del muestreo
+ * 
+ * Esta tarea:
+ * 1. Se despierta una vez cada MUESTREO_BASE_MS con xTaskDelayUntil
+ * 2. Notifica a cada tarea registrada cuya ranura coincide con el tick actual
+ *    (periodo redondeado a múltiplos de la rejilla)
+ * 
+ * Así todas las lecturas del periodo ocurren en la misma ventana y el resto
+ * del tiempo queda como un único periodo inactivo largo.
+ * 
+ * Comunicación:
+ * - Notificaciones directas a las tareas de muestreo
+ */
+void tareaCoordinadorMuestreo(void *pvParameters) {
+  TickType_t ultimo = xTaskGetTickCount();
+  uint32_t tick = 0;
+
+  while (1) {
+    xTaskDelayUntil(&ultimo, pdMS_TO_TICKS(MUESTREO_BASE_MS));
+    tick++;
+
+    portENTER_CRITICAL(&muestreoMux);
+    int n = muestreoNumTareas;
+    TareaMuestreo tareas[MUESTREO_MAX_TAREAS];
+    memcpy(tareas, muestreoTareas, sizeof(TareaMuestreo) * n);
+    portEXIT_CRITICAL(&muestreoMux);
+
+    for (int i = 0; i < n; i++) {
+      uint32_t ranuras = max((uint32_t)1, (tareas[i].periodoMs + MUESTREO_BASE_MS / 2) / MUESTREO_BASE_MS);
+      if (tick % ranuras == 0) xTaskNotifyGive(tareas[i].tarea);
+    }
+  }
+}
+
+/**
+ * @brief Muestra el histograma de huecos entre despertares de las tareas coordinadas
+ */
+void muestreoReportar() {
+  Serial.printf("Huecos tareas coordinadas (%s):", MUESTREO_ALINEADO ? "alineado" : "independiente");
+  for (int i = 0; i < MUESTREO_CUBETAS; i++) {
+    if (muestreoHistograma[i] > 0) {
+      Serial.printf(" <%lums:%lu", (unsigned long)(1UL << i), (unsigned long)muestreoHistograma[i]);
+    }
+  }
+  Serial.println();
+}
+
+// Estado de la fusión de temperatura (protegido por fusionMux)
+portMUX_TYPE fusionMux = portMUX_INITIALIZER_UNLOCKED;  ///< Protege el estado de la fusión
+// El estado aprendido se guarda en memoria RTC: cada despertar dura solo unos
+// segundos y, si empezara de cero, el periodo del DHT11 nunca llegaría a crecer
+RTC_DATA_ATTR bool fusionConOffset = false;        ///< Ya hay al menos una lectura del DHT11
+RTC_DATA_ATTR int32_t fusionOffset = 0;            ///< Offset estimado DHT11 - DS3231 (centésimas de °C)
+int32_t fusionRtc = INT32_MIN;                     ///< Última temperatura del DS3231 en este arranque (centésimas de °C)
+RTC_DATA_ATTR int32_t fusionRtcEnDht = INT32_MIN;  ///< Temperatura del DS3231 en la última lectura del DHT11
+RTC_DATA_ATTR int fusionAcuerdos = 0;              ///< Lecturas concordantes consecutivas
+RTC_DATA_ATTR bool fusionDiscrepa = false;         ///< La última lectura del DHT11 no concordó con el offset
+RTC_DATA_ATTR uint32_t fusionPeriodoDht = DHT_PERIODO_MIN_MS;  ///< Periodo actual de lectura del DHT11
+
+/**
+ * @brief Incorpora una lectura del DHT11 a la fusión
+ * 
+ * Esta función:
+ * 1. Compara la lectura con DS3231 + offset estimado
+ * 2. Si concuerda dentro de FUSION_TOLERANCIA, suma un acuerdo y, tras
+ *    FUSION_ACUERDOS, duplica el periodo del DHT11 (hasta DHT_PERIODO_MAX_MS)
+ * 3. Si no concuerda, vuelve al periodo mínimo y marca la discrepancia:
+ *    hasta que una lectura vuelva a concordar no hay temperatura fusionada
+ *    y las tramas llevan la del DHT11 directamente
+ * 4. Actualiza el offset con un filtro exponencial en punto fijo
+ */
+void fusionActualizarDht(float temperatura) {
+  int32_t dht = (int32_t)lroundf(temperatura * 100);
+
+  portENTER_CRITICAL(&fusionMux);
+  if (fusionRtc != INT32_MIN) {
+    int32_t diferencia = dht - fusionRtc;
+    if (!fusionConOffset) {
+      fusionOffset = diferencia;
+      fusionConOffset = true;
+    } else if (abs(diferencia - fusionOffset) <= FUSION_TOLERANCIA) {
+      fusionDiscrepa = false;
+      if (++fusionAcuerdos >= FUSION_ACUERDOS) {
+        fusionAcuerdos = 0;
+        fusionPeriodoDht = min((uint32_t)DHT_PERIODO_MAX_MS, fusionPeriodoDht * 2);
+      }
+    } else {
+      fusionAcuerdos = 0;
+      fusionPeriodoDht = DHT_PERIODO_MIN_MS;
+      fusionDiscrepa = true;
+    }
+    fusionOffset += (diferencia - fusionOffset) / (1 << FUSION_K);
+    fusionRtcEnDht = fusionRtc;
+  }
+  portEXIT_CRITICAL(&fusionMux);
+}
+
+/**
+ * @brief Incorpora una lectura del sensor interno del DS3231 a la fusión
+ * 
+ * Si la temperatura del DS3231 se aleja más de FUSION_TOLERANCIA de la que
+ * tenía en la última lectura del DHT11, el DHT11 vuelve al periodo mínimo.
+ */
+void fusionActualizarRtc(int32_t temperatura) {
+  portENTER_CRITICAL(&fusionMux);
+  fusionRtc = temperatura;
+  if (fusionRtcEnDht != INT32_MIN && abs(temperatura - fusionRtcEnDht) > FUSION_TOLERANCIA) {
+    fusionAcuerdos = 0;
+    fusionPeriodoDht = DHT_PERIODO_MIN_MS;
+  }
+  portEXIT_CRITICAL(&fusionMux);
+}
+
+/**
+ * @brief Temperatura fusionada en °C para una lectura dada del DS3231 (o -1 si no la hay)
+ * 
+ * Es la temperatura del DS3231 corregida con el offset estimado, por lo que
+ * sigue variando entre lecturas espaciadas del DHT11. No la hay sin offset
+ * ni mientras el DHT11 discrepa: el filtro tarda varias lecturas en seguir
+ * un salto y, entretanto, el offset podría desviarse más de FUSION_TOLERANCIA. Se pasa la lectura del
+ * DS3231 de un instante concreto (la de un tick del RTC); el offset varía
+ * lentamente y se toma el actual.
+ */
+float fusionTemperaturaEn(int32_t temperaturaRtc) {
+  portENTER_CRITICAL(&fusionMux);
+  bool valida = fusionConOffset && !fusionDiscrepa;
+  int32_t fusionada = temperaturaRtc + fusionOffset;
+  portEXIT_CRITICAL(&fusionMux);
+  return valida ? fusionada / 100.0f : -1;
+}
+
+/**
+ * @brief Devuelve el periodo actual de lectura del DHT11 en ms
+ */
+uint32_t fusionPeriodoDhtMs() {
+  portENTER_CRITICAL(&fusionMux);
+  uint32_t periodo = fusionPeriodoDht;
+  portEXIT_CRITICAL(&fusionMux);
+  return periodo;
+}
+
+/**
+ * @enum PartidaId
+ * @brief Colas y buffers del pipeline que reparte el presupuesto de memoria
+ */
+enum PartidaId : uint8_t {
+  PARTIDA_SENSOR,   ///< sensorQueue
+  PARTIDA_RTC,      ///< rtcQueue
+  PARTIDA_TRAMAS,   ///< Buffer de la consola serie (tramaBuffer)
+  PARTIDA_DIAG,     ///< Buffer de la salida de diagnóstico
+  PARTIDA_ENLACE,   ///< enlaceQueue
+  PARTIDA_ALARMAS,  ///< alarmaQueue
+  PARTIDA_JOIN,     ///< joinQueue
+  PARTIDAS          ///< Número de partidas
+};
+
+/**
+ * @struct PartidaMemoria
+ * @brief Cola o buffer con su tamaño en elementos y su pico de ocupación
+ * 
+ * Los buffers de bytes se miden en mensajes de tramas empaquetadas, así todas las
+ * partidas se reparten y se observan en la misma unidad.
+ */
+struct PartidaMemoria {
+  const char *nombre;        ///< Nombre (también clave en NVS, máximo 15 caracteres)
+  uint16_t elemento;         ///< Bytes por elemento
+  uint16_t minimo;           ///< Elementos mínimos para funcionar
+  uint16_t preferido;        ///< Elementos sin datos de una ejecución anterior
+  uint8_t prioridad;         ///< Las de mayor prioridad se atienden antes
+  uint16_t picoPrevio;       ///< Pico de la ejecución anterior (0: desconocido)
+  volatile uint16_t pico;    ///< Pico observado en esta ejecución
+  uint16_t asignado;         ///< Elementos asignados
+};
+
+PartidaMemoria partidas[PARTIDAS];  ///< Partidas del presupuesto
+
+/**
+ * @brief Declara una partida del presupuesto (en setup, antes de repartir)
+ */
+void partidaDeclarar(PartidaId id, const char *nombre, uint16_t elemento, uint16_t minimo,
+                     uint16_t preferido, uint8_t prioridad) {
+  partidas[id] = {nombre, elemento, minimo, preferido, prioridad, 0, 0, preferido};
+}
+
+/**
+ * @brief Anota la ocupación actual de una partida (en elementos)
+ */
+void partidaAnotarPico(PartidaId id, uint32_t elementos) {
+  if (elementos > partidas[id].pico) partidas[id].pico = elementos;
+}
+
+/**
+ * @brief Bytes asignados a una partida
+ */
+size_t partidaBytes(PartidaId id) {
+  return (size_t)partidas[id].asignado * partidas[id].elemento;
+}
+
+/**
+ * @brief Ocupación actual de una partida en elementos
+ */
+uint32_t partidaOcupacion(PartidaId id) {
+  switch (id) {
+    case PARTIDA_SENSOR: return uxQueueMessagesWaiting(sensorQueue);
+    case PARTIDA_RTC: return uxQueueMessagesWaiting(rtcQueue);
+    case PARTIDA_ENLACE: return uxQueueMessagesWaiting(enlaceQueue);
+    case PARTIDA_ALARMAS: return uxQueueMessagesWaiting(alarmaQueue);
+    case PARTIDA_JOIN: return uxQueueMessagesWaiting(joinQueue);
+    case PARTIDA_TRAMAS:
+    case PARTIDA_DIAG: {
+      Sink *sink = id == PARTIDA_TRAMAS ? sinkSerie : sinkDiag;
+      if (sink == NULL) return 0;
+      uint32_t usados = sink->bufferBytes - xMessageBufferSpacesAvailable(sink->buffer);
+      return (usados + partidas[id].elemento - 1) / partidas[id].elemento;
+    }
+    default: return 0;
+  }
+}
+
+/**
+ * @brief Reparte PRESUPUESTO_BYTES entre las partidas declaradas
+ * 
+ * Esta función:
+ * 1. Lee de NVS el pico de cada partida en la ejecución anterior
+ * 2. Asigna a todas su mínimo
+ * 3. En orden de prioridad, amplía cada una hasta su demanda (pico más
+ *    PRESUPUESTO_MARGEN_PCT, o el tamaño preferido si no hay pico) mientras
+ *    quede presupuesto
+ * 4. Muestra el reparto y la holgura restante (con REPORTES_ACTIVOS y consola)
+ */
+void presupuestoRepartir() {
+  xSemaphoreTake(nvsMutex, portMAX_DELAY);
+  preferencias.begin("memoria", true);
+  for (PartidaMemoria &p : partidas) p.picoPrevio = preferencias.getUShort(p.nombre, 0);
+  preferencias.end();
+  xSemaphoreGive(nvsMutex);
+
+  int32_t restante = PRESUPUESTO_BYTES;
+  for (PartidaMemoria &p : partidas) {
+    p.asignado = p.minimo;
+    restante -= p.minimo * p.elemento;
+  }
+  if (restante < 0) {
+    Serial.println("MEMORIA_EXCEDIDA los mínimos no caben en PRESUPUESTO_BYTES");
+    restante = 0;
+  }
+
+  bool atendida[PARTIDAS] = {};
+  for (int n = 0; n < PARTIDAS; n++) {
+    int elegida = -1;
+    for (int i = 0; i < PARTIDAS; i++) {
+      if (!atendida[i] && (elegida < 0 || partidas[i].prioridad > partidas[elegida].prioridad)) elegida = i;
+    }
+    atendida[elegida] = true;
+    PartidaMemoria &p = partidas[elegida];
+    uint32_t demanda = p.picoPrevio > 0
+        ? max((uint32_t)p.minimo, ((uint32_t)p.picoPrevio * (100 + PRESUPUESTO_MARGEN_PCT) + 99) / 100)
+        : p.preferido;
+    uint32_t extra = min(demanda - min(demanda, (uint32_t)p.asignado), (uint32_t)restante / p.elemento);
+    p.asignado += extra;
+    restante -= extra * p.elemento;
+  }
+
+#if REPORTES_ACTIVOS
+  if (!consolaConectada) return;
+  for (const PartidaMemoria &p : partidas) {
+    Serial.printf("MEMORIA %s pico_previo %u asignado %u bytes %lu\n", p.nombre,
+                  (unsigned)p.picoPrevio, (unsigned)p.asignado,
+                  (unsigned long)((uint32_t)p.asignado * p.elemento));
+  }
+  Serial.printf("MEMORIA presupuesto %lu holgura %ld\n", (unsigned long)PRESUPUESTO_BYTES, (long)restante);
+#endif
+}
+
+/**
+ * @brief Guarda en NVS los picos de esta ejecución para el próximo reparto
+ * 
+ * El pico guardado decae un 25 % por ejecución si no se vuelve a alcanzar,
+ * así una ejecución tranquila no encoge de golpe una partida. Solo se
+ * escribe en flash si el valor cambia.
+ */
+void presupuestoGuardarPicos() {
+  xSemaphoreTake(nvsMutex, portMAX_DELAY);
+  preferencias.begin("memoria", false);
+  for (const PartidaMemoria &p : partidas) {
+    uint16_t nuevo = max((uint16_t)p.pico, (uint16_t)(p.picoPrevio - p.picoPrevio / 4));
+    if (nuevo != p.picoPrevio) preferencias.putUShort(p.nombre, nuevo);
+  }
+  preferencias.end();
+  xSemaphoreGive(nvsMutex);
+}
+
+#if PERFIL_COLAS
+RTC_DATA_ATTR uint32_t perfilHistograma[PARTIDAS][PERFIL_CUBETAS];  ///< Muestras por ocupación (acumuladas entre despertares)
+RTC_DATA_ATTR uint32_t perfilMuestras = 0;                          ///< Muestras registradas
+
+/**
+ * @brief Tarea de perfilado: muestrea la ocupación de todas las partidas
+ * 
+ * Se ejecuta cada PERFIL_PERIODO_MS con prioridad alta para que el
+ * muestreo no dependa de la carga. Los histogramas se conservan en memoria
+ * RTC, así un perfilado puede abarcar varios despertares.
+ */
+void tareaPerfilColas(void *pvParameters) {
+  TickType_t ultimo = xTaskGetTickCount();
+  while (1) {
+    vTaskDelayUntil(&ultimo, pdMS_TO_TICKS(PERFIL_PERIODO_MS));
+    for (int i = 0; i < PARTIDAS; i++) {
+      uint32_t ocupacion = partidaOcupacion((PartidaId)i);
+      perfilHistograma[i][min(ocupacion, (uint32_t)PERFIL_CUBETAS - 1)]++;
+    }
+    perfilMuestras++;
+  }
+}
+
+/**
+ * @brief Muestra los histogramas y la configuración recomendada
+ * 
+ * Para cada partida se recomienda la menor longitud d cuya probabilidad
+ * observada de ocupación >= d no supera PERFIL_PROB_DESBORDE_PPM (con d
+ * elementos, una llegada con la cola en d se perdería). Si la partida llegó
+ * a llenarse con más frecuencia que el objetivo, la muestra está censurada:
+ * se marca como saturada y se recomienda al menos el doble de lo actual.
+ * Las líneas PERFIL_CONFIG pueden copiarse tal cual a la configuración.
+ */
+void perfilReportar() {
+  static const char *const defines[PARTIDAS] = {
+    "SENSOR_COLA_LONGITUD", "RTC_COLA_LONGITUD", "TRAMA_BUFFER_BYTES",
+    "SINK_DIAG_BUFFER_BYTES", "ENLACE_COLA_LONGITUD", "ALARMA_COLA_LONGITUD",
+    "JOIN_COLA_LONGITUD"};
+  if (perfilMuestras == 0) return;
+
+  uint32_t limite = (uint64_t)perfilMuestras * PERFIL_PROB_DESBORDE_PPM / 1000000;
+  uint32_t bytesActuales = 0, bytesRecomendados = 0;
+  for (int i = 0; i < PARTIDAS; i++) {
+    const PartidaMemoria &p = partidas[i];
+    const uint32_t *h = perfilHistograma[i];
+
+    uint32_t cola = 0;
+    int d = PERFIL_CUBETAS;
+    int maximo = 0;
+    for (int k = PERFIL_CUBETAS - 1; k >= 0; k--) {
+      if (h[k] > 0 && maximo == 0) maximo = k;
+      if (d == k + 1 && cola + h[k] <= limite) {
+        cola += h[k];
+        d = k;
+      }
+    }
+    bool saturada = (p.asignado < PERFIL_CUBETAS && h[p.asignado] > limite) || d == PERFIL_CUBETAS;
+    uint32_t recomendado = max((uint32_t)p.minimo, (uint32_t)d);
+    if (saturada) recomendado = max(recomendado, (uint32_t)(2 * p.asignado));
+
+    bytesActuales += (uint32_t)p.asignado * p.elemento;
+    bytesRecomendados += recomendado * p.elemento;
+    Serial.printf("PERFIL %s muestras %lu max %d actual %u recomendado %lu%s |", p.nombre,
+                  (unsigned long)perfilMuestras, maximo, (unsigned)p.asignado,
+                  (unsigned long)recomendado, saturada ? " saturada" : "");
+    for (int k = 0; k <= maximo; k++) Serial.printf(" %lu", (unsigned long)h[k]);
+    Serial.println();
+
+    bool enBytes = i == PARTIDA_TRAMAS || i == PARTIDA_DIAG;
+    Serial.printf("PERFIL_CONFIG #define %s %lu\n", defines[i],
+                  (unsigned long)(enBytes ? recomendado * p.elemento : recomendado));
+  }
+  Serial.printf("PERFIL ram actual %lu recomendada %lu (desborde <= %u ppm)\n",
+                (unsigned long)bytesActuales, (unsigned long)bytesRecomendados,
+                (unsigned)PERFIL_PROB_DESBORDE_PPM);
+}
+#endif
+
+/**
+ * @enum NivelCarga
+ * @brief Niveles de descarte del controlador de carga, en orden de aplicación
+ * 
+ * Cada nivel incluye los descartes de los anteriores. La adquisición nunca
+ * se descarta por nivel ni se bloquea: las tareas de lectura envían sin
+ * espera y solo pierden la muestra si la cola está llena.
+ */
+enum NivelCarga : uint8_t {
+  CARGA_NORMAL,         ///< Todo activo
+  CARGA_SIN_CONSOLA,    ///< Sin salida detallada por consola (tareaMostrar)
+  CARGA_SIN_DERIVADAS,  ///< Sin métricas derivadas (análisis de parpadeo, salida de diagnóstico)
+  CARGA_SIN_LUZ,        ///< Sin muestras que solo llevan luz (tareaLDR)
+};
+
+volatile uint8_t nivelCarga = CARGA_NORMAL;     ///< Nivel de descarte actual
+volatile bool metricasDerivadasActivas = true;  ///< Conexión de la salida de diagnóstico
+volatile uint32_t cargaIdle[portNUM_PROCESSORS];  ///< Llamadas al gancho de inactividad por núcleo
+uint8_t cargaNivelMax = CARGA_NORMAL;           ///< Nivel más alto alcanzado
+uint32_t cargaCambios = 0;                      ///< Cambios de nivel
+std::atomic<uint32_t> descartesConsola{0};      ///< Salidas de consola omitidas
+std::atomic<uint32_t> descartesDerivadas{0};    ///< Capturas de parpadeo omitidas
+std::atomic<uint32_t> descartesLuz{0};          ///< Muestras de luz no enviadas
+std::atomic<uint32_t> descartesColaLlena{0};    ///< Muestras perdidas por cola llena
+std::atomic<uint32_t> lecturasResumidas{0};    ///< Lecturas resumidas o sustituidas por falta de crédito
+
+/**
+ * @brief Gancho de la tarea inactiva: cuenta las veces que un núcleo queda libre
+ * 
+ * Devuelve true para que la tarea inactiva espere a la siguiente interrupción,
+ * así hay aproximadamente una llamada por tick libre.
+ */
+bool cargaIdleHook() {
+  cargaIdle[xPortGetCoreID()]++;
+  return true;
+}
+
+/**
+ * @brief Ocupación de una cola en porcentaje
+ */
+uint32_t cargaOcupacion(QueueHandle_t cola) {
+  UBaseType_t usados = uxQueueMessagesWaiting(cola);
+  UBaseType_t total = usados + uxQueueSpacesAvailable(cola);
+  return total > 0 ? usados * 100 / total : 0;
+}
+
+/**
+ * @brief Tarea del controlador de carga
+ * 
+ * Esta tarea:
+ * 1. Cada CARGA_PERIODO_MS mide la ocupación de sensorQueue, rtcQueue y
+ *    tramaBuffer y el uso de CPU (ticks sin llamadas al gancho de inactividad),
+ *    y anota los picos de todas las partidas del presupuesto de memoria
+ * 2. Sube un nivel de descarte si la ocupación o la CPU superan su umbral alto
+ * 3. Baja un nivel cuando ambas quedan por debajo de su umbral bajo
+ * 
+ * Sincronización:
+ * - Prioridad mayor que el resto para seguir evaluando con el sistema saturado
+ * - Solo escribe nivelCarga y metricasDerivadasActivas; las tareas los consultan
+ */
+void tareaControlCarga(void *pvParameters) {
+  uint32_t idlePrevio = 0;
+  TickType_t ticksPrevio = xTaskGetTickCount();
+
+  while (1) {
+    vTaskDelay(pdMS_TO_TICKS(CARGA_PERIODO_MS));
+
+    uint32_t ocupacion = max(max(cargaOcupacion(sensorQueue), cargaOcupacion(rtcQueue)),
+                             cargaOcupacion(joinQueue));
+    uint32_t tramaCapacidad = sinkSerie->bufferBytes;
+    uint32_t tramaUsados = tramaCapacidad - xMessageBufferSpacesAvailable(tramaBuffer);
+    ocupacion = max(ocupacion, tramaUsados * 100 / tramaCapacidad);
+
+    // Picos para el presupuesto de memoria de la próxima ejecución
+    for (int i = 0; i < PARTIDAS; i++) {
+      partidaAnotarPico((PartidaId)i, partidaOcupacion((PartidaId)i));
+    }
+
+    uint32_t idle = 0;
+    for (int i = 0; i < portNUM_PROCESSORS; i++) idle += cargaIdle[i];
+    TickType_t ticks = xTaskGetTickCount();
+    uint32_t posibles = (ticks - ticksPrevio) * portNUM_PROCESSORS;
+    uint32_t libre = posibles > 0 ? min((uint32_t)100, (idle - idlePrevio) * 100 / posibles) : 100;
+    uint32_t cpu = 100 - libre;
+    idlePrevio = idle;
+    ticksPrevio = ticks;
+
+    uint8_t nivel = nivelCarga;
+    if ((ocupacion >= CARGA_OCUPACION_ALTA || cpu >= CARGA_CPU_ALTA) && nivel < CARGA_SIN_LUZ) {
+      nivel++;
+    } else if (ocupacion <= CARGA_OCUPACION_BAJA && cpu <= CARGA_CPU_BAJA && nivel > CARGA_NORMAL) {
+      nivel--;
+    }
+    if (nivel != nivelCarga) {
+      nivelCarga = nivel;
+      metricasDerivadasActivas = nivel < CARGA_SIN_DERIVADAS;
+      cargaNivelMax = max(cargaNivelMax, nivel);
+      cargaCambios++;
+    }
+  }
+}
+
+/**
+ * @brief Indica si se puede escribir la salida detallada por consola
+ * 
+ * Cuenta como descarte la salida omitida por el controlador de carga (no la
+ * omitida porque no haya consola conectada o porque haya un backfill en curso).
+ */
+bool cargaPermiteConsola() {
+  if (!consolaConectada || backfillActivo) return false;
+  if (nivelCarga >= CARGA_SIN_CONSOLA) {
+    descartesConsola++;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Muestra por serial los contadores del controlador de carga
+ * 
+ * Con CARGA_CONTROL_ACTIVO incluye la inactividad real de la CPU desde el
+ * arranque (ticks libres contados por cargaIdleHook en todos los núcleos).
+ */
+void cargaReportar() {
+  uint32_t libre = 0;
+#if CARGA_CONTROL_ACTIVO
+  uint32_t idle = 0;
+  for (int i = 0; i < portNUM_PROCESSORS; i++) idle += cargaIdle[i];
+  uint32_t posibles = xTaskGetTickCount() * portNUM_PROCESSORS;
+  if (posibles > 0) libre = min((uint32_t)100, idle * 100 / posibles);
+#endif
+  Serial.printf("CARGA nivel %u max %u cambios %lu | descartes consola %lu derivadas %lu "
+                "luz %lu cola_llena %lu | resumidas %lu | cpu_libre %lu%%\n",
+                (unsigned)nivelCarga, (unsigned)cargaNivelMax, (unsigned long)cargaCambios,
+                (unsigned long)descartesConsola, (unsigned long)descartesDerivadas,
+                (unsigned long)descartesLuz, (unsigned long)descartesColaLlena,
+                (unsigned long)lecturasResumidas, (unsigned long)libre);
+}
+
+/**
+ * @brief Envía el resumen acumulado si el consumidor ha anunciado capacidad
+ * 
+ * Toma un crédito sin esperar; sin crédito, las lecturas siguen acumuladas
+ * y se enviarán resumidas cuando el consumidor devuelva alguno.
+ */
+void creditoEnviarResumen(AgregadoSensor &agregado) {
+  if (agregado.muestras == 0 || xSemaphoreTake(creditosSensor, 0) != pdPASS) return;
+  if (agregado.muestras > 1) lecturasResumidas += agregado.muestras;
+  SensorData data = agregado.extraer(secuenciaSiguiente(secuenciaMuestra));
+  if (xQueueSend(sensorQueue, &data, 0) != pdPASS) {
+    descartesColaLlena++;
+    xSemaphoreGive(creditosSensor);
+  }
+}
+
+/**
+ * @brief Acceso a los periféricos de medida
+ * 
+ * Todas las tareas leen los sensores a través de estas funciones. Con
+ * SIMULAR_PERIFERICOS devuelven señales sintéticas deterministas (derivadas
+ * del tiempo desde el arranque), de modo que la imagen completa puede
+ * ejecutarse en el emulador QEMU del ESP32, que no emula el bus del DHT11,
+ * el ADC ni el DS3231. La luz sintética incluye una componente de 120 Hz
+ * para ejercitar también el análisis de parpadeo. La alarma del DS3231
+ * tampoco existe en simulación: programarla o liberarla no hace nada y, con
+ * DESPERTAR_POR_ALARMA_RTC, despierta el timer de respaldo.
+ */
+#if SIMULAR_PERIFERICOS
+uint32_t relojSimuladoBase = 0;  ///< unixtime simulado en el arranque
+
+float leerTemperaturaDht() { return 22.0f + 3.0f * sinf(2 * M_PI * (micros() / 1e6f) / 600); }
+float leerHumedadDht() { return 60.0f + 15.0f * sinf(2 * M_PI * (micros() / 1e6f) / 900); }
+int leerLuz() {
+  float t = micros() / 1e6f;
+  return (int)(400 + 200 * sinf(2 * M_PI * t / 120) + 50 * sinf(2 * M_PI * 120 * t));
+}
+DateTime relojCrudo() {
+  if (relojSimuladoBase == 0) relojSimuladoBase = DateTime(F(__DATE__), F(__TIME__)).unixtime();
+  return DateTime(relojSimuladoBase + millis() / 1000);
+}
+float leerTemperaturaRtc() { return 21.75f + 3.0f * sinf(2 * M_PI * (micros() / 1e6f) / 600); }
+void relojLiberarAlarma() {}
+void relojProgramarAlarma(uint32_t crudo) {}
+#else
+float leerTemperaturaDht() { return dht.readTemperature(); }
+float leerHumedadDht() { return dht.readHumidity(); }
+int leerLuz() { return analogRead(LDRPIN); }
+DateTime relojCrudo() { return rtc.now(); }
+float leerTemperaturaRtc() { return rtc.getTemperature(); }
+void relojLiberarAlarma() { rtc.clearAlarm(1); }
+void relojProgramarAlarma(uint32_t crudo) {
+  rtc.disableAlarm(2);
+  rtc.clearAlarm(1);
+  rtc.writeSqwPinMode(DS3231_OFF);  // INT/SQW como salida de interrupción
+  rtc.setAlarm1(DateTime(crudo), DS3231_A1_Date);
+}
+#endif
+
+// Corrección del DS3231 estimada por la sincronización con el host
+RTC_DATA_ATTR bool syncValida = false;         ///< Hay una estimación de offset
+RTC_DATA_ATTR uint32_t syncRefUnix = 0;        ///< Instante de referencia (unixtime del DS3231)
+RTC_DATA_ATTR int32_t syncOffsetMs = 0;        ///< Hora del host - hora del DS3231 en syncRefUnix
+RTC_DATA_ATTR int32_t syncDerivaPpb = 0;       ///< Lo que adelanta el host al DS3231 (partes por mil millones)
+
+/**
+ * @brief Segundos que hay que sumar a la hora del DS3231 para tener la del host
+ */
+int32_t relojCorreccionS(uint32_t crudo) {
+  if (!syncValida) return 0;
+  int64_t ms = syncOffsetMs + (int64_t)syncDerivaPpb * (int32_t)(crudo - syncRefUnix) / 1000000;
+  return (int32_t)((ms + (ms >= 0 ? 500 : -500)) / 1000);
+}
+
+/**
+ * @brief Hora de pared corregida con el offset y la deriva estimados
+ * 
+ * Es el servicio de reloj de todas las tareas: la lectura del DS3231 más
+ * una corrección lineal (una multiplicación), sin tocar el DS3231.
+ */
+DateTime relojAhora() {
+  DateTime crudo = relojCrudo();
+  int32_t correccion = relojCorreccionS(crudo.unixtime());
+  return correccion == 0 ? crudo : DateTime(crudo.unixtime() + correccion);
+}
+
+/**
+ * @brief Tarea para lectura del sensor DHT11
+ * 
+ * Esta tarea se ejecuta cada 2 a 16 segundos (según la fusión de temperatura) y:
+ * 1. Lee temperatura y humedad del sensor DHT11
+ * 2. Verifica que las lecturas sean válidas
+ * 3. Incorpora la temperatura a la fusión con el DS3231
+ * 4. Crea una estructura SensorData con los valores leídos y su número de secuencia
+ * 5. Envía los datos a sensorQueue si tiene crédito; si no, los resume con las
+ *    lecturas siguientes (media) sin alterar su ritmo de lectura
+ * 
+ * Comunicación:
+ * - Productor de la cola sensorQueue (envía datos)
+ * - No consume de ninguna cola
+ * - Se despierta en la rejilla del coordinador de muestreo
+ * 
+ */
+void tareaDHT(void *pvParameters) {
+  AgregadoSensor agregado = AgregadoSensor();
+
+  while (1) {
+    uint32_t capturaUs = micros();
+    float temp = leerTemperaturaDht();
+    float hum = leerHumedadDht();
+
+    if (!isnan(temp) && !isnan(hum)) {  
+      fusionActualizarDht(temp);
+      agregado.anotar(temp, hum, -1, capturaUs);
+      creditoEnviarResumen(agregado);
+    } else if (!backfillActivo) {
+      xSemaphoreTake(enlaceMutex, portMAX_DELAY);
+      Serial.println("Error al leer el sensor DHT11");
+      xSemaphoreGive(enlaceMutex);
+    }
+
+    muestreoEsperar(fusionPeriodoDhtMs());
+  }
+}
+
+/**
+ * @brief Tarea para lectura del sensor LDR
+ * 
+ * Esta tarea se ejecuta cada segundo y:
+ * 1. Lee el valor analógico del LDR 
+ * 2. Crea una estructura SensorData con el valor de luz y su número de secuencia
+ * 3. Envía los datos a sensorQueue si tiene crédito; si no, los resume con
+ *    las lecturas siguientes (nunca en el nivel CARGA_SIN_LUZ del controlador)
+ * 
+ * Comunicación:
+ * - Productor de la cola sensorQueue (envía datos)
+ * - No consume de ninguna cola
+ * - Se despierta en la rejilla del coordinador de muestreo
+ */
+void tareaLDR(void *pvParameters) {
+  AgregadoSensor agregado = AgregadoSensor();
+
+  while (1) {
+    uint32_t capturaUs = micros();
+    int lightValue = leerLuz();
+    if (nivelCarga >= CARGA_SIN_LUZ) {
+      descartesLuz++;
+    } else {
+      agregado.anotar(-1, -1, lightValue, capturaUs);
+      creditoEnviarResumen(agregado);
+    }
+    muestreoEsperar(1000);
+  }
+}
+
+// Buffers del análisis de parpadeo (estáticos para no cargar la pila)
+int16_t parpadeoRe[PARPADEO_MUESTRAS];      ///< Parte real (muestras y luego espectro)
+int16_t parpadeoIm[PARPADEO_MUESTRAS];      ///< Parte imaginaria
+int16_t fftCos[PARPADEO_MUESTRAS / 2];      ///< Tabla de cosenos Q15
+int16_t fftSin[PARPADEO_MUESTRAS / 2];      ///< Tabla de senos Q15
+RTC_DATA_ATTR uint32_t parpadeoUltimaUnix = 0;  ///< Última captura (unixtime del DS3231, sobrevive al Deep Sleep)
+
+/**
+ * @brief FFT radix-2 en punto fijo Q15, in situ
+ * 
+ * Decimación en el tiempo con escalado 1/2 en cada etapa, de modo que no
+ * hay desbordamiento y el resultado queda dividido por n.
+ * Las tablas fftCos/fftSin deben estar inicializadas (fftIniciarTablas).
+ */
+void fftQ15(int16_t *re, int16_t *im, int n) {
+  // Reordenación por inversión de bits
+  for (int i = 1, j = 0; i < n; i++) {
+    int bit = n >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) {
+      int16_t t = re[i]; re[i] = re[j]; re[j] = t;
+      t = im[i]; im[i] = im[j]; im[j] = t;
+    }
+  }
+
+  // Mariposas
+  for (int len = 2; len <= n; len <<= 1) {
+    int paso = n / len;
+    for (int i = 0; i < n; i += len) {
+      for (int k = 0; k < len / 2; k++) {
+        int32_t wr = fftCos[k * paso];
+        int32_t wi = -fftSin[k * paso];
+        int a = i + k;
+        int b = a + len / 2;
+        int32_t tr = (re[b] * wr - im[b] * wi) >> 15;
+        int32_t ti = (re[b] * wi + im[b] * wr) >> 15;
+        re[b] = (re[a] - tr) >> 1;
+        im[b] = (im[a] - ti) >> 1;
+        re[a] = (re[a] + tr) >> 1;
+        im[a] = (im[a] + ti) >> 1;
+      }
+    }
+  }
+}
+
+/**
+ * @brief Rellena las tablas fftCos/fftSin para PARPADEO_MUESTRAS puntos
+ * 
+ * La llaman tareaParpadeo y benchTareas; el benchmark corre aunque
+ * PARPADEO_ACTIVO sea 0.
+ */
+void fftIniciarTablas() {
+  for (int k = 0; k < PARPADEO_MUESTRAS / 2; k++) {
+    float angulo = 2 * M_PI * k / PARPADEO_MUESTRAS;
+    fftCos[k] = (int16_t)lroundf(cosf(angulo) * 32767);
+    fftSin[k] = (int16_t)lroundf(sinf(angulo) * 32767);
+  }
+}
+
+/**
+ * @brief Tarea de análisis de parpadeo del LDR
+ * 
+ * Esta tarea se ejecuta cada PARPADEO_PERIODO_MS y:
+ * 0. Mide el periodo con el DS3231 desde la última captura guardada en
+ *    memoria RTC: el equipo solo está despierto unos segundos por ciclo, así
+ *    que un temporizador que empiece de cero en cada arranque nunca vencería
+ * 1. Captura PARPADEO_MUESTRAS lecturas del LDR a PARPADEO_FRECUENCIA_HZ,
+ *    con la prioridad elevada a PARPADEO_PRIORIDAD_CAPTURA para que el ritmo
+ *    sea regular; al no superar a tareaAlarma, la espera activa de la
+ *    captura retrasa una alarma como mucho un tick (reparto por tiempo)
+ * 2. Calcula el índice de parpadeo (área sobre la media / área total) y el
+ *    porcentaje de parpadeo ((max - min) / (max + min))
+ * 3. Quita la media, aplica la FFT Q15 y busca la frecuencia dominante
+ * 4. Muestra los resultados por serial
+ * 
+ * Comunicación:
+ * - No usa colas; se despierta en la rejilla del coordinador de muestreo
+ */
+void tareaParpadeo(void *pvParameters) {
+  fftIniciarTablas();
+  const uint32_t intervaloUs = 1000000UL / PARPADEO_FRECUENCIA_HZ;
+
+  while (1) {
+    uint32_t transcurridoS = relojCrudo().unixtime() - parpadeoUltimaUnix;
+    if (parpadeoUltimaUnix != 0 && transcurridoS < PARPADEO_PERIODO_MS / 1000) {
+      muestreoEsperar((PARPADEO_PERIODO_MS / 1000 - transcurridoS) * 1000);
+      continue;
+    }
+    parpadeoUltimaUnix = relojCrudo().unixtime();
+    if (nivelCarga >= CARGA_SIN_DERIVADAS) {
+      descartesDerivadas++;
+      continue;
+    }
+
+    // 1. Captura del bloque
+    UBaseType_t prioridad = uxTaskPriorityGet(NULL);
+    vTaskPrioritySet(NULL, PARPADEO_PRIORIDAD_CAPTURA);
+    uint32_t siguienteUs = micros();
+    for (int i = 0; i < PARPADEO_MUESTRAS; i++) {
+      while ((int32_t)(micros() - siguienteUs) < 0) {}
+      parpadeoRe[i] = leerLuz();
+      siguienteUs += intervaloUs;
+    }
+    vTaskPrioritySet(NULL, prioridad);
+
+    // 2. Índice y porcentaje de parpadeo
+    int32_t suma = 0, minimo = INT16_MAX, maximo = 0;
+    for (int i = 0; i < PARPADEO_MUESTRAS; i++) {
+      suma += parpadeoRe[i];
+      minimo = min(minimo, (int32_t)parpadeoRe[i]);
+      maximo = max(maximo, (int32_t)parpadeoRe[i]);
+    }
+    int32_t media = suma / PARPADEO_MUESTRAS;
+    int32_t sobreMedia = 0;
+    for (int i = 0; i < PARPADEO_MUESTRAS; i++) {
+      if (parpadeoRe[i] > media) sobreMedia += parpadeoRe[i] - media;
+    }
+    uint32_t indiceMilesimas = suma > 0 ? (uint32_t)((int64_t)sobreMedia * 1000 / suma) : 0;
+    uint32_t porcentajeMilesimas = (maximo + minimo) > 0 ? (uint32_t)((maximo - minimo) * 1000 / (maximo + minimo)) : 0;
+
+    // 3. Espectro de la componente alterna (12 bits -> Q15)
+    for (int i = 0; i < PARPADEO_MUESTRAS; i++) {
+      parpadeoRe[i] = (int16_t)((parpadeoRe[i] - media) << 3);
+      parpadeoIm[i] = 0;
+    }
+    fftQ15(parpadeoRe, parpadeoIm, PARPADEO_MUESTRAS);
+
+    int dominante = 1;
+    int32_t potenciaMax = -1;
+    for (int k = 1; k < PARPADEO_MUESTRAS / 2; k++) {
+      int32_t potencia = (int32_t)parpadeoRe[k] * parpadeoRe[k] + (int32_t)parpadeoIm[k] * parpadeoIm[k];
+      if (potencia > potenciaMax) {
+        potenciaMax = potencia;
+        dominante = k;
+      }
+    }
+    uint32_t frecuenciaHz = (uint32_t)dominante * PARPADEO_FRECUENCIA_HZ / PARPADEO_MUESTRAS;
+
+    // 4. Resultado
+    if (backfillActivo) continue;
+    xSemaphoreTake(enlaceMutex, portMAX_DELAY);
+    Serial.printf("Parpadeo: índice %lu.%03lu, porcentaje %lu.%lu%%, dominante %lu Hz\n",
+                  (unsigned long)(indiceMilesimas / 1000), (unsigned long)(indiceMilesimas % 1000),
+                  (unsigned long)(porcentajeMilesimas / 10), (unsigned long)(porcentajeMilesimas % 10),
+                  (unsigned long)frecuenciaHz);
+    xSemaphoreGive(enlaceMutex);
+  }
+}
+
+/**
+ * @brief Tarea para lectura del RTC
+ * 
+ * Esta tarea se ejecuta cada segundo y:
+ * 1. Obtiene la fecha y hora actual del compilador
+ * 2. Lee el sensor de temperatura interno del DS3231 y lo pasa a la fusión
+ * 3. Crea una estructura RTCData con los valores
+ * 4. Envía los datos a rtcQueue si tiene crédito; si no, la lectura queda
+ *    sustituida por la siguiente (solo interesa la hora más reciente)
+ * 
+ * Comunicación:
+ * - Productor de la cola rtcQueue (envía datos)
+ * - No consume de ninguna cola
+ * - Se despierta en la rejilla del coordinador de muestreo
+ */
+void tareaRTC(void *pvParameters) {
+  while (1) {
+    uint32_t capturaUs = micros();
+    DateTime now = relojAhora();
+    int temperaturaRtc = (int)lroundf(leerTemperaturaRtc() * 100);
+    fusionActualizarRtc(temperaturaRtc);
+    RTCData rtcData = {now.hour(), now.minute(), now.second(), 
+                       now.day(), now.month(), now.year(), temperaturaRtc, capturaUs};
+    if (xSemaphoreTake(creditosRtc, 0) != pdPASS) {
+      lecturasResumidas++;
+    } else if (xQueueSend(rtcQueue, &rtcData, 0) != pdPASS) {
+      descartesColaLlena++;
+      xSemaphoreGive(creditosRtc);
+    }
+    muestreoEsperar(1000);
+  }
+}
+
+/**
+ * @brief Señaliza una alarma a tareaAlarma
+ * 
+ * capturaUs es el instante de lectura de la muestra que dispara la alarma;
+ * si ya había una pendiente se conserva la más antigua para que la latencia
+ * extremo a extremo no quede subestimada.
+ * 
+ * Con notificaciones directas los bits se acumulan con OR (eSetBits): aunque
+ * lleguen varias señales mientras el LED está encendido, tareaAlarma ve
+ * todas las reglas y la severidad más alta. Con ALARMA_CON_SEMAFORO se usa el
+ * semáforo binario original, que solo transmite "hubo alarma".
+ */
+void alarmaSenalizar(uint32_t bits, uint32_t capturaUs) {
+  if (!alarmaMuestraPendiente) {
+    alarmaMuestraUs = capturaUs;
+    alarmaMuestraPendiente = true;
+  }
+  if (alarmaEsperando && !alarmaSenalMedible) {
+    alarmaSenalUs = micros();
+    alarmaSenalMedible = true;
+  } else {
+    alarmaAcumuladas++;
+  }
+#if ALARMA_CON_SEMAFORO
+  xSemaphoreGive(ledSemaphore);
+#else
+  xTaskNotify(tareaAlarmaHandle, bits, eSetBits);
+#endif
+}
+
+/**
+ * @brief Tarea para mostrar datos y gestionar alarmas
+
+ * Esta tarea:
+ * 1. Recibe datos de sensorQueue 
+ *    - Muestra temperatura/humedad o luz por serial si hay consola de texto
+ *    - Notifica a tareaAlarma con las reglas disparadas y la severidad si
+ *      supera umbrales (temp>24 y hum>70 o luz>500)
+ *    - Envía un EventoAlarma a alarmaQueue cuando cambian las reglas activas
+ * 2. Recibe datos de rtcQueue 
+ *    - Muestra fecha y hora formateada por serial si hay consola de texto
+ * 3. Devuelve un crédito por cada elemento procesado
+ * 4. Reenvía cada muestra y cada tick a joinQueue para tareaCrearTrama
+ * 
+ * Comunicación:
+ * - Único consumidor de sensorQueue y rtcQueue (recibe datos)
+ * - Productor de joinQueue
+ * - Notificación directa a tareaAlarma (para activar alarma)
+ * - Productor de alarmaQueue (carril prioritario del enlace)
+ * 
+ * Sincronización:
+ * - Usa notificaciones directas para indicar condición de alarma a tareaAlarma
+ */
+void tareaMostrar(void *pvParameters) {
+  SensorData receivedData;
+  RTCData rtcData;
+  uint8_t reglasActivas = 0;
+
+  while (1) {
+    // Procesar datos de sensores
+    if (xQueueReceive(sensorQueue, &receivedData, pdMS_TO_TICKS(100)) == pdPASS) {
+      bool verbosa = cargaPermiteConsola();
+      if (verbosa) xSemaphoreTake(enlaceMutex, portMAX_DELAY);
+      if (verbosa && receivedData.temperature != -1 && receivedData.humidity != -1) {
+        Serial.print("Temp: "); Serial.print(receivedData.temperature);
+        Serial.print(" C - Hum: "); Serial.print(receivedData.humidity);
+        Serial.println("%");
+      }
+      if (verbosa && receivedData.light != -1) {
+        Serial.print("Luz: "); Serial.println(receivedData.light);
+      }
+      if (verbosa) xSemaphoreGive(enlaceMutex);
+
+      // Lógica de alarma: cada regla se evalúa con su propio canal
+      uint8_t disparadas = 0;
+      if (receivedData.temperature > 24 && receivedData.humidity > 70) {
+        disparadas |= ALARMA_REGLA_TEMP_HUM;
+      }
+      if (receivedData.light > 500) {
+        disparadas |= ALARMA_REGLA_LUZ;
+      }
+
+      uint8_t reglas = reglasActivas;
+      if (receivedData.temperature != -1 && receivedData.humidity != -1) {
+        reglas = (reglas & ~ALARMA_REGLA_TEMP_HUM) | (disparadas & ALARMA_REGLA_TEMP_HUM);
+      }
+      if (receivedData.light != -1) {
+        reglas = (reglas & ~ALARMA_REGLA_LUZ) | (disparadas & ALARMA_REGLA_LUZ);
+      }
+
+      if (disparadas != 0) {
+        bool variasReglas = (reglas & (reglas - 1)) != 0;
+        alarmaSenalizar(disparadas | (variasReglas ? ALARMA_SEVERIDAD_CRITICA : ALARMA_SEVERIDAD_AVISO),
+                        receivedData.capturaUs);
+      }
+
+      // Cambios de estado de las reglas hacia el enlace
+      if (reglas != reglasActivas) {
+        EventoAlarma evento = {reglas, receivedData.secuencia, (uint32_t)micros()};
+        xQueueSend(alarmaQueue, &evento, 0);
+        reglasActivas = reglas;
+      }
+      xSemaphoreGive(creditosSensor);
+
+      EventoJoin evento;
+      evento.esTick = false;
+      evento.muestra = receivedData;
+      if (xQueueSend(joinQueue, &evento, 0) != pdPASS) joinDescartadas++;
+    }
+
+    // Procesar datos del RTC
+    if (xQueueReceive(rtcQueue, &rtcData, pdMS_TO_TICKS(100)) == pdPASS) {
+      if (cargaPermiteConsola()) {
+        xSemaphoreTake(enlaceMutex, portMAX_DELAY);
+        Serial.printf("Fecha: %02d/%02d/%04d - Hora: %02d:%02d:%02d\n",
+                      rtcData.day, rtcData.month, rtcData.year,
+                      rtcData.hour, rtcData.minute, rtcData.second);
+        xSemaphoreGive(enlaceMutex);
+      }
+      xSemaphoreGive(creditosRtc);
+
+      EventoJoin evento;
+      evento.esTick = true;
+      evento.tick = rtcData;
+      if (xQueueSend(joinQueue, &evento, 0) != pdPASS) joinDescartadas++;
+    }
+  }
+}
+
+/**
+ * @brief Tarea para controlar el LED de alarma
+ * 
+ * Esta tarea:
+ * 1. Espera indefinidamente una notificación con los bits de alarma
+ * 2. Cuando la recibe:
+ *    - Mide la latencia desde la señal hasta su despertar (solo si la señal
+ *      la encontró bloqueada; las acumuladas con el LED encendido se cuentan aparte)
+ *    - Enciende el LED por 500ms (aviso) o 1500ms (crítica)
+ *    - Anota la latencia extremo a extremo (lectura de la muestra -> LED) y,
+ *      con MEDIR_LATENCIA_LOOPBACK, la del flanco real leído en LOOPBACK_PIN
+ *    - Lo apaga
+ * 
+ * Comunicación:
+ * - Consumidor de notificaciones directas (reglas ALARMA_REGLA_* y severidad
+ *   ALARMA_SEVERIDAD_*), o del semáforo ledSemaphore con ALARMA_CON_SEMAFORO
+ * - No produce datos para otras tareas
+ * 
+ * Sincronización:
+ * - Se bloquea hasta que tareaMostrar la notifica
+ * - Prioridad más alta para respuesta rápida
+ */
+void tareaAlarma(void *pvParameters) {
+  uint32_t bits;
+
+  while (1) {
+    alarmaSenalMedible = false;
+    alarmaEsperando = true;
+#if ALARMA_CON_SEMAFORO
+    bool recibida = xSemaphoreTake(ledSemaphore, portMAX_DELAY) == pdPASS;
+    bits = ALARMA_SEVERIDAD_AVISO;
+#else
+    bool recibida = xTaskNotifyWait(0, UINT32_MAX, &bits, portMAX_DELAY) == pdPASS;
+#endif
+    alarmaEsperando = false;
+    if (recibida && alarmaSenalMedible) {
+      uint32_t latencia = micros() - alarmaSenalUs;
+      alarmaDespertarMin = min(alarmaDespertarMin, latencia);
+      alarmaDespertarMax = max(alarmaDespertarMax, latencia);
+      alarmaDespertarSuma += latencia;
+      alarmaDespertares++;
+    }
+    if (recibida) {
+
+      uint32_t muestraUs = alarmaMuestraUs;
+      alarmaMuestraPendiente = false;
+      digitalWrite(LED_PIN, HIGH);
+      latenciaAnotar(latenciaSoftware, micros() - muestraUs);
+
+      vTaskDelay(pdMS_TO_TICKS((bits & ALARMA_SEVERIDAD_CRITICA) ? 1500 : 500));
+#if MEDIR_LATENCIA_LOOPBACK
+      latenciaAnotar(latenciaLoopback, loopbackFlancoUs - muestraUs);
+#endif
+      digitalWrite(LED_PIN, LOW);
+    }
+  }
+}
+
+/**
+ * @struct MuestraJoin
+ * @brief Muestra de un canal con su tiempo de evento
+ */
+struct MuestraJoin {
+  uint32_t us;      ///< Instante de captura (micros)
+  float valor[2];   ///< Valores del canal (temperatura y humedad, o luz)
+};
+
+/**
+ * @struct CanalJoin
+ * @brief Últimas muestras de un canal, ordenadas por tiempo de evento
+ * 
+ * Las muestras pueden llegar desordenadas respecto a los ticks del RTC (el
+ * DHT11 tarda en leer y las colas se consumen por lotes), así que no basta
+ * con la última recibida: cada tick toma la más reciente anterior a él.
+ * Solo se guardan JOIN_HISTORIA muestras, así la memoria está acotada.
+ */
+struct CanalJoin {
+  MuestraJoin historia[JOIN_HISTORIA];  ///< Muestras, la más antigua primero
+  uint8_t n;                            ///< Muestras guardadas
+  uint32_t maximoUs;                    ///< Mayor tiempo de evento recibido
+
+  /**
+   * @brief Inserta una muestra en orden; con la historia llena pierde la más antigua
+   */
+  void insertar(uint32_t us, float a, float b) {
+    if (n == 0 || (int32_t)(us - maximoUs) > 0) maximoUs = us;
+    int i = n;
+    if (n == JOIN_HISTORIA) {
+      if ((int32_t)(us - historia[0].us) < 0) return;
+      memmove(&historia[0], &historia[1], (JOIN_HISTORIA - 1) * sizeof(MuestraJoin));
+      i--;
+    } else {
+      n++;
+    }
+    while (i > 0 && (int32_t)(historia[i - 1].us - us) > 0) {
+      historia[i] = historia[i - 1];
+      i--;
+    }
+    historia[i] = {us, {a, b}};
+  }
+
+  /**
+   * @brief Muestra más reciente no posterior a us
+   * 
+   * Si todas son posteriores devuelve la más antigua (la más próxima a us);
+   * sin muestras devuelve NULL.
+   */
+  const MuestraJoin *hasta(uint32_t us) const {
+    if (n == 0) return NULL;
+    for (int i = n - 1; i > 0; i--) {
+      if ((int32_t)(historia[i].us - us) <= 0) return &historia[i];
+    }
+    return &historia[0];
+  }
+};
+
+// Estado del join (solo lo usa tareaCrearTrama)
+CanalJoin joinDht = CanalJoin();         ///< Temperatura y humedad del DHT11
+CanalJoin joinLuz = CanalJoin();         ///< Nivel de luz del LDR
+RTCData joinTicks[JOIN_TICKS_MAX];       ///< Ticks del RTC pendientes, en orden de evento
+int joinPrimero = 0;                     ///< Índice del tick pendiente más antiguo
+int joinPendientes = 0;                  ///< Ticks pendientes
+bool joinHayTick = false;                ///< Se ha recibido al menos un tick
+uint32_t joinUltimoTickUs = 0;           ///< Tiempo de evento del último tick recibido
+uint32_t joinAdmitidoUs = 0;             ///< Tiempo de evento del último tick que dio trama
+bool joinHayEmitido = false;             ///< Se ha ensamblado al menos una trama
+uint32_t joinEmitidoUs = 0;              ///< Tiempo de evento de la última trama ensamblada
+uint32_t joinTardias = 0;                ///< Muestras que llegaron después de ensamblar su instante
+uint32_t joinForzadas = 0;               ///< Ticks ensamblados antes de la marca por falta de espacio
+uint32_t joinEnsambladas = 0;            ///< Tramas ensambladas
+
+/**
+ * @brief Incorpora una muestra de sensorQueue al canal que corresponda
+ * 
+ * El tiempo de evento es capturaUs (la lectura más antigua si la muestra
+ * resume varias). Una muestra anterior a la última trama ensamblada es
+ * tardía: se cuenta y se conserva para las tramas siguientes.
+ */
+void joinAnotarMuestra(const SensorData &data) {
+  if (joinHayEmitido && (int32_t)(data.capturaUs - joinEmitidoUs) <= 0) joinTardias++;
+  if (data.temperature != -1 || data.humidity != -1) {
+    joinDht.insertar(data.capturaUs, data.temperature, data.humidity);
+  }
+  if (data.light != -1) joinLuz.insertar(data.capturaUs, data.light, 0);
+}
+
+/**
+ * @brief Marca de agua: instante hasta el que no se esperan más muestras
+ * 
+ * Es el menor de los tiempos de evento máximos de los tres canales (todos
+ * han avanzado hasta ahí), pero nunca más de JOIN_RETRASO_MAX_MS por detrás
+ * del evento más reciente: un canal lento o parado (el DHT11 a 16 s, la luz
+ * en CARGA_SIN_LUZ) no retiene las tramas más allá del retraso admitido.
+ */
+uint32_t joinMarca() {
+  uint32_t canales[] = {joinDht.maximoUs, joinLuz.maximoUs, joinUltimoTickUs};
+  bool vistos[] = {joinDht.n > 0, joinLuz.n > 0, joinHayTick};
+  uint32_t ultimo = joinUltimoTickUs;
+  uint32_t minimo = joinUltimoTickUs;
+  bool todos = true;
+  for (int i = 0; i < 3; i++) {
+    if (!vistos[i]) {
+      todos = false;
+      continue;
+    }
+    if ((int32_t)(canales[i] - ultimo) > 0) ultimo = canales[i];
+    if ((int32_t)(canales[i] - minimo) < 0) minimo = canales[i];
+  }
+  uint32_t marca = ultimo - JOIN_RETRASO_MAX_MS * 1000UL;
+  if (todos && (int32_t)(minimo - marca) > 0) marca = minimo;
+  return marca;
+}
+
+/**
+ * @brief Ensambla la trama del tick pendiente más antiguo y la registra en el WAL
+ * 
+ * La temperatura es la fusionada DS3231 + DHT11 cuando está disponible,
+ * calculada con la temperatura del DS3231 que trae el propio tick; si no
+ * (sin offset o con el DHT11 discrepando), la última lectura del DHT11.
+ */
+void joinEnsamblar() {
+  const RTCData &tick = joinTicks[joinPrimero];
+  const MuestraJoin *dht = joinDht.hasta(tick.capturaUs);
+  const MuestraJoin *luz = joinLuz.hasta(tick.capturaUs);
+  float temperatura = dht ? dht->valor[0] : -1;
+  float humedad = dht ? dht->valor[1] : -1;
+  float fusionada = fusionTemperaturaEn(tick.temperaturaRtc);
+  if (fusionada != -1) temperatura = fusionada;
+
+  walAgregar(secuenciaSiguiente(secuenciaTrama),
+             tramaEmpaquetar(tick, temperatura, humedad, luz ? (int)luz->valor[0] : -1));
+  joinHayEmitido = true;
+  joinEmitidoUs = tick.capturaUs;
+  joinEnsambladas++;
+  joinPrimero = (joinPrimero + 1) % JOIN_TICKS_MAX;
+  joinPendientes--;
+}
+
+/**
+ * @brief Encola un tick del RTC; si no hay sitio ensambla antes el más antiguo
+ * 
+ * Todos los ticks avanzan la marca de agua, pero solo da trama uno cada
+ * JOIN_PERIODO_MS (con medio segundo de tolerancia a la fase de los ticks).
+ */
+void joinAnotarTick(const RTCData &tick) {
+  bool admitido = !joinHayTick ||
+                  (int32_t)(tick.capturaUs - joinAdmitidoUs) >= (int32_t)(JOIN_PERIODO_MS - 500) * 1000;
+  joinHayTick = true;
+  joinUltimoTickUs = tick.capturaUs;
+  if (!admitido) return;
+  joinAdmitidoUs = tick.capturaUs;
+  if (joinPendientes == JOIN_TICKS_MAX) {
+    joinForzadas++;
+    joinEnsamblar();
+  }
+  joinTicks[(joinPrimero + joinPendientes) % JOIN_TICKS_MAX] = tick;
+  joinPendientes++;
+}
+
+/**
+ * @brief Muestra por serial las tramas ensambladas y las muestras tardías
+ */
+void joinReportar() {
+  Serial.printf("JOIN ensambladas %lu tardias %lu forzadas %lu descartadas %lu pendientes %d\n",
+                (unsigned long)joinEnsambladas, (unsigned long)joinTardias,
+                (unsigned long)joinForzadas, (unsigned long)joinDescartadas, joinPendientes);
+}
+
+/**
+ * @brief Tarea para crear tramas formateadas
+ * 
+ * Esta tarea:
+ * 1. Recibe de joinQueue la copia de cada muestra y tick que reenvía tareaMostrar
+ * 2. Guarda las muestras por canal según su tiempo de evento (capturaUs)
+ * 3. Deja cada tick del RTC pendiente hasta que la marca de agua lo supera
+ *    (ningún canal puede traer ya una muestra anterior, o se ha agotado el
+ *    retraso admitido JOIN_RETRASO_MAX_MS)
+ * 4. Ensambla cada tick con la muestra más reciente de cada canal anterior a
+ *    él y empaqueta una TramaBinaria con su número de secuencia (sin
+ *    formatear: el texto lo genera la salida que lo necesite)
+ * 5. Registra la trama en el WAL; tras el commit del grupo se envía a tramaBuffer
+ * 
+ * Comunicación:
+ * - Consumidor de joinQueue
+ * - Productor de tramaBuffer (a través de walCommit)
+ */
+void tareaCrearTrama(void *pvParameters) {
+  EventoJoin evento;
+
+  while (1) {
+    if (xQueueReceive(joinQueue, &evento, pdMS_TO_TICKS(1000)) == pdPASS) {
+      do {
+        if (evento.esTick) {
+          joinAnotarTick(evento.tick);
+        } else {
+          joinAnotarMuestra(evento.muestra);
+        }
+      } while (xQueueReceive(joinQueue, &evento, 0) == pdPASS);
+    }
+
+    uint32_t marca = joinMarca();
+    while (joinPendientes > 0 && (int32_t)(marca - joinTicks[joinPrimero].capturaUs) >= 0) {
+      joinEnsamblar();
+    }
+
+    walCommitSiVence();
+  }
+}
+
+/**
+ * @struct EventoEnlace
+ * @brief Comando recibido del host por el enlace serie
+ * 
+ * Esta estructura se usa para enviar comandos a través de enlaceQueue.
+ */
+struct EventoEnlace {
+  char tipo;           ///< 'A' confirmación acumulativa, 'N' retransmisión selectiva
+  uint32_t secuencia;  ///< Secuencia a la que se refiere el comando
+};
+
+/**
+ * @struct TramaEnVuelo
+ * @brief Trama enviada por el enlace y aún no confirmada por el host
+ * 
+ * El texto se guarda en arqArena, una arena circular de bytes que se reserva
+ * y libera en orden FIFO, así cada trama ocupa solo su longitud real.
+ */
+struct TramaEnVuelo {
+  uint32_t inicio;     ///< Offset del registro dentro del WAL
+  uint32_t fin;        ///< Offset del final del registro dentro del WAL
+  uint32_t secuencia;  ///< Número de secuencia de la trama
+  uint16_t offset;     ///< Posición del texto en arqArena
+  uint16_t len;        ///< Longitud del texto
+  uint32_t envioMs;    ///< Instante de la última transmisión
+};
+
+// Estado del protocolo de repetición selectiva (solo lo usa tareaMostrarTrama)
+TramaEnVuelo arqVentana[ARQ_VENTANA];  ///< Anillo de tramas sin confirmar
+uint8_t arqArena[ARQ_ARENA_BYTES];     ///< Texto de las tramas sin confirmar
+uint16_t arqArenaCola = 0;             ///< Próxima posición libre de arqArena
+int arqPrimera = 0;                    ///< Índice de la trama sin confirmar más antigua
+int arqPendientes = 0;                 ///< Tramas sin confirmar
+bool arqActivo = false;                ///< El host confirma tramas (si no, se envía sin confirmación)
+uint32_t arqUltimoContactoMs = 0;      ///< Último comando recibido del host
+uint32_t arqEnviadas = 0;              ///< Tramas transmitidas por primera vez
+uint32_t arqRetransmitidas = 0;        ///< Retransmisiones (por NACK o por timeout)
+
+/**
+ * @brief Compara números de secuencia teniendo en cuenta el desbordamiento
+ */
+bool secuenciaMenorIgual(uint32_t a, uint32_t b) {
+  return (int32_t)(a - b) <= 0;
+}
+
+/**
+ * @brief Busca en el WAL la trama con una secuencia dada
+ * 
+ * Se usa para atender NACKs de tramas que ya no están en el anillo o que
+ * nunca llegaron a tramaBuffer.
+ */
+bool walBuscarSecuencia(uint32_t secuencia, TramaLog &trama) {
+  bool encontrada = false;
+  xSemaphoreTake(walMutex, portMAX_DELAY);
+  File f = LittleFS.open(WAL_RUTA, FILE_READ);
+  if (f) {
+    f.seek(walEntregado);
+    uint8_t cabecera[WAL_CABECERA];
+    while (!encontrada && f.read(cabecera, 2) == 2) {
+      uint32_t inicio = f.position() - 2;
+      uint8_t len = cabecera[1];
+      if (cabecera[0] != WAL_REG_TRAMA && !tramaEsBinaria(cabecera[0])) {
+        f.seek(f.position() + len);
+        continue;
+      }
+      if (f.read(&cabecera[2], 4) != 4) break;
+      memcpy(&trama.secuencia, &cabecera[2], sizeof(trama.secuencia));
+      if (trama.secuencia == secuencia && f.read((uint8_t *)trama.texto, len) == len) {
+        trama.tipo = cabecera[0];
+        trama.inicio = inicio;
+        trama.fin = inicio + WAL_CABECERA + len;
+        uint16_t lenTexto = len;
+        encontrada = tramaComoTexto(trama, lenTexto);
+        if (!encontrada) break;
+      } else {
+        f.seek(f.position() + len);
+      }
+    }
+    f.close();
+  }
+  xSemaphoreGive(walMutex);
+  return encontrada;
+}
+
+/**
+ * @brief Busca hueco contiguo para len bytes en arqArena
+ * 
+ * Devuelve la posición o -1 si no cabe. Como las tramas se liberan en el
+ * mismo orden en que se reservan, basta con mirar tras la cola y, si no
+ * cabe al final, al principio de la arena antes de la trama más antigua.
+ */
+int arqArenaReservar(uint16_t len) {
+  if (arqPendientes == 0) {
+    return len <= ARQ_ARENA_BYTES ? 0 : -1;
+  }
+  uint16_t cabeza = arqVentana[arqPrimera].offset;
+  if (arqArenaCola > cabeza) {
+    if (ARQ_ARENA_BYTES - arqArenaCola >= len) return arqArenaCola;
+    if (cabeza >= len) return 0;
+    return -1;
+  }
+  return (cabeza - arqArenaCola >= len) ? arqArenaCola : -1;
+}
+
 /**
- * @struct RTCData
- * @brief Estructura para almacenar datos de fecha y hora
- * 
- * Esta estructura se usa para enviar datos a través de rtcQueue.
+ * @brief Indica si la ventana ARQ admite una trama de len bytes más
  */
-struct RTCData {
-  int hour;    ///< Hora actual 
-  int minute;  ///< Minutos actuales 
-  int second;  ///< Segundos actuales 
-  int day;     ///< Día del mes 
-  int month;   ///< Mes actual 
-  int year;    ///< Año actual 
-};
+bool arqHayHueco(uint16_t len) {
+  return !arqActivo || (arqPendientes < ARQ_VENTANA && arqArenaReservar(len) >= 0);
+}
 
 /**
- * @brief Tarea para lectura del sensor DHT11
- * 
- * Esta tarea se ejecuta cada 2 segundos y:
- * 1. Lee temperatura y humedad del sensor DHT11
- * 2. Verifica que las lecturas sean válidas
- * 3. Crea una estructura SensorData con los valores leídos
- * 4. Envía los datos a sensorQueue (cola de 10 elementos)
- * 
- * Comunicación:
- * - Productor de la cola sensorQueue (envía datos)
- * - No consume de ninguna cola
- * 
+ * @brief Escribe en el enlace una trama guardada en el anillo ARQ
  */
-void tareaDHT(void *pvParameters) {
-  while (1) {
-    float temp = dht.readTemperature();
-    float hum = dht.readHumidity();
+void arqRetransmitir(TramaEnVuelo &enVuelo) {
+  Serial.write(&arqArena[enVuelo.offset], enVuelo.len);
+  Serial.println();
+  enVuelo.envioMs = millis();
+  arqRetransmitidas++;
+}
 
-    if (!isnan(temp) && !isnan(hum)) {  
-      SensorData data = {temp, hum, -1};
-      xQueueSend(sensorQueue, &data, portMAX_DELAY);
-    } else {
-      Serial.println("Error al leer el sensor DHT11");
-    }
+/**
+ * @brief Saca del anillo la trama más antigua y la marca entregada en el WAL
+ */
+void arqLiberarPrimera() {
+  TramaEnVuelo &primera = arqVentana[arqPrimera];
+  walAvanzarSiRegistrada(primera.inicio, primera.fin);
+  arqPrimera = (arqPrimera + 1) % ARQ_VENTANA;
+  arqPendientes--;
+  if (arqPendientes == 0) arqArenaCola = 0;
+}
 
-    vTaskDelay(pdMS_TO_TICKS(2000));
+/**
+ * @brief Registra una trama recién transmitida
+ * 
+ * Sin host que confirme, la trama se da por entregada al escribirla.
+ * Con ARQ activo queda en el anillo hasta recibir su confirmación
+ * (el llamador comprueba antes el hueco con arqHayHueco).
+ */
+void arqRegistrarEnvio(const TramaLog &trama, uint16_t len) {
+  arqEnviadas++;
+  int offset = arqActivo ? arqArenaReservar(len) : -1;
+  if (offset < 0) {
+    walMarcarEntregada(trama);
+    return;
   }
+  TramaEnVuelo &hueco = arqVentana[(arqPrimera + arqPendientes) % ARQ_VENTANA];
+  hueco.inicio = trama.inicio;
+  hueco.fin = trama.fin;
+  hueco.secuencia = trama.secuencia;
+  hueco.offset = offset;
+  hueco.len = len;
+  hueco.envioMs = millis();
+  memcpy(&arqArena[offset], trama.texto, len);
+  arqArenaCola = offset + len;
+  arqPendientes++;
 }
 
 /**
- * @brief Tarea para lectura del sensor LDR
- * 
- * Esta tarea se ejecuta cada segundo y:
- * 1. Lee el valor analógico del LDR 
- * 2. Crea una estructura SensorData con el valor de luz
- * 3. Envía los datos a sensorQueue
+ * @brief Procesa una confirmación o un NACK del host
  * 
- * Comunicación:
- * - Productor de la cola sensorQueue (envía datos)
- * - No consume de ninguna cola
+ * - 'A': libera del anillo todas las tramas con secuencia <= N y las marca entregadas
+ * - 'N': retransmite la trama N desde el anillo o, si no está, desde el WAL
+ *
+ * En el host, RangoSecuencias (rango_secuencias.h) da ambos: el fin del
+ * primer rango para 'A' y un 'N' por cada secuencia de los huecos.
  */
-void tareaLDR(void *pvParameters) {
-  while (1) {
-    int lightValue = analogRead(LDRPIN);
-    SensorData data = {-1, -1, lightValue};
-    xQueueSend(sensorQueue, &data, portMAX_DELAY);
-    vTaskDelay(pdMS_TO_TICKS(1000));
+void arqProcesarEvento(const EventoEnlace &evento) {
+  arqActivo = true;
+  arqUltimoContactoMs = millis();
+
+  if (evento.tipo == 'A') {
+    while (arqPendientes > 0 &&
+           secuenciaMenorIgual(arqVentana[arqPrimera].secuencia, evento.secuencia)) {
+      arqLiberarPrimera();
+    }
+  } else if (evento.tipo == 'N') {
+    for (int i = 0; i < arqPendientes; i++) {
+      TramaEnVuelo &enVuelo = arqVentana[(arqPrimera + i) % ARQ_VENTANA];
+      if (enVuelo.secuencia == evento.secuencia) {
+        arqRetransmitir(enVuelo);
+        return;
+      }
+    }
+    TramaLog trama;
+    if (walBuscarSecuencia(evento.secuencia, trama)) {
+      Serial.println(trama.texto);
+      arqRetransmitidas++;
+    }
   }
 }
 
 /**
- * @brief Tarea para lectura del RTC
- * 
- * Esta tarea se ejecuta cada segundo y:
- * 1. Obtiene la fecha y hora actual del compilador
- * 2. Crea una estructura RTCData con los valores
- * 3. Envía los datos a rtcQueue (cola de 5 elementos)
+ * @brief Retransmite la trama más antigua si su confirmación no llega a tiempo
  * 
- * Comunicación:
- * - Productor de la cola rtcQueue (envía datos)
- * - No consume de ninguna cola
+ * Si el host deja de responder durante ARQ_INACTIVO_MS se vuelve al modo sin
+ * confirmación; las tramas no confirmadas siguen pendientes en el WAL y se
+ * reproducen en el próximo arranque.
  */
-void tareaRTC(void *pvParameters) {
-  while (1) {
-    DateTime now = rtc.now();
-    RTCData rtcData = {now.hour(), now.minute(), now.second(), 
-                       now.day(), now.month(), now.year()};
-    xQueueSend(rtcQueue, &rtcData, portMAX_DELAY);
-    vTaskDelay(pdMS_TO_TICKS(1000));
+void arqRevisarTimeout() {
+  if (!arqActivo) return;
+
+  uint32_t ahora = millis();
+  if (ahora - arqUltimoContactoMs >= ARQ_INACTIVO_MS) {
+    arqActivo = false;
+    arqPendientes = 0;
+    arqArenaCola = 0;
+    return;
+  }
+  if (arqPendientes > 0 && ahora - arqVentana[arqPrimera].envioMs >= ARQ_TIMEOUT_MS) {
+    arqRetransmitir(arqVentana[arqPrimera]);
   }
 }
 
 /**
- * @brief Tarea para mostrar datos y gestionar alarmas
-
+ * @brief Tarea para mostrar tramas formateadas
+ * 
  * Esta tarea:
- * 1. Recibe datos de sensorQueue 
- *    - Muestra temperatura/humedad o luz por serial
- *    - Activa semáforo si supera umbrales (temp>24 y hum>70 o luz>500)
- * 2. Recibe datos de rtcQueue 
- *    - Muestra fecha y hora formateada por serial
+ * 1. Escribe los eventos de alarma en cuanto llegan (carril prioritario)
+ * 2. Atiende las confirmaciones y NACKs del host (repetición selectiva)
+ * 3. Espera tramas de tramaBuffer (el buffer de sinkSerie), como máximo
+ *    SINK_SERIE_LOTE cada SINK_SERIE_PERIODO_MS
+ * 4. Si hay consola de texto, las formatea y las muestra por el puerto serial
+ *    si la ventana ARQ no está llena (sin consola quedan pendientes en el WAL)
+ * 5. Marca la trama como entregada en el WAL al confirmarse (o al enviarla si
+ *    no hay host que confirme)
+ * 6. No emite nada mientras hay un backfill en curso (durante el volcado es
+ *    tareaBackfill quien atiende el carril de alarmas)
  * 
  * Comunicación:
- * - Consumidor de sensorQueue y rtcQueue (recibe datos)
- * - Productor del semáforo ledSemaphore (para activar alarma)
- * 
- * Sincronización:
- * - Usa semáforo para indicar condición de alarma a tareaAlarma
+ * - Consumidor de alarmaQueue, tramaBuffer y enlaceQueue
+ * - No produce datos para otras tareas
  */
-void tareaMostrar(void *pvParameters) {
-  SensorData receivedData;
-  RTCData rtcData;
+void tareaMostrarTrama(void *pvParameters) {
+  TramaLog trama;
+  EventoEnlace evento;
+  uint32_t ultimoLoteMs = 0;
+  int loteRestante = 0;
+  bool primerLote = true;
 
   while (1) {
-    // Procesar datos de sensores
-    if (xQueueReceive(sensorQueue, &receivedData, pdMS_TO_TICKS(100)) == pdPASS) {
-      if (receivedData.temperature != -1 && receivedData.humidity != -1) {
-        Serial.print("Temp: "); Serial.print(receivedData.temperature);
-        Serial.print(" C - Hum: "); Serial.print(receivedData.humidity);
-        Serial.println("%");
-      }
-      if (receivedData.light != -1) {
-        Serial.print("Luz: "); Serial.println(receivedData.light);
-      }
+    if (backfillActivo) {
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
 
-      // Lógica de alarma
-      if ((receivedData.temperature > 24 && receivedData.humidity > 70) || 
-          receivedData.light > 500) {
-        xSemaphoreGive(ledSemaphore); // Notificar alarma
-      }
+    // Carril de alarmas: la espera de la tarea se hace aquí para despertar al instante
+    enlaceAtenderAlarmas(pdMS_TO_TICKS(100));
+
+    // Comandos del host
+    if (xQueueReceive(enlaceQueue, &evento, 0) == pdPASS) {
+      xSemaphoreTake(enlaceMutex, portMAX_DELAY);
+      arqProcesarEvento(evento);
+      xSemaphoreGive(enlaceMutex);
+      continue;
     }
+    xSemaphoreTake(enlaceMutex, portMAX_DELAY);
+    arqRevisarTimeout();
+    xSemaphoreGive(enlaceMutex);
 
-    // Procesar datos del RTC
-    if (xQueueReceive(rtcQueue, &rtcData, pdMS_TO_TICKS(100)) == pdPASS) {
-      Serial.printf("Fecha: %02d/%02d/%04d - Hora: %02d:%02d:%02d\n",
-                    rtcData.day, rtcData.month, rtcData.year,
-                    rtcData.hour, rtcData.minute, rtcData.second);
+    // Nueva trama, respetando el ritmo y el lote de la salida y la ventana
+    size_t siguiente = xMessageBufferNextLengthBytes(tramaBuffer);
+    if (siguiente > 0 && loteRestante == 0 &&
+        (primerLote || millis() - ultimoLoteMs >= sinkSerie->periodoMs)) {
+      loteRestante = sinkSerie->lote;
+      ultimoLoteMs = millis();
+      primerLote = false;
+      sinkSerie->lotes++;
+    }
+    if (siguiente > 0 && loteRestante > 0 && consolaConectada &&
+        arqHayHueco(TRAMA_TEXTO_BINARIA_MAX)) {
+      size_t recibidos = xMessageBufferReceive(tramaBuffer, &trama, sizeof(trama), 0);
+      uint16_t len = recibidos - TRAMA_CABECERA_MSG;
+      if (!tramaComoTexto(trama, len)) {
+        sinkSerie->sinFormato++;
+        walMarcarEntregada(trama);
+        continue;
+      }
+      xSemaphoreTake(enlaceMutex, portMAX_DELAY);
+      Serial.println(trama.texto);
+      xSemaphoreGive(enlaceMutex);
+      arqRegistrarEnvio(trama, len);
+      sinkSerie->entregadas++;
+      sinkSerie->bytes += len;
+      loteRestante--;
     }
   }
 }
 
+// Sincronización de hora con el host (protocolo tipo NTP sobre el enlace)
+RTC_DATA_ATTR uint32_t syncMuestraUnix[SYNC_MUESTRAS];  ///< Instante de cada offset (unixtime del DS3231)
+RTC_DATA_ATTR int32_t syncMuestraMs[SYNC_MUESTRAS];     ///< Offsets medidos (ms)
+RTC_DATA_ATTR int syncNumMuestras = 0;                  ///< Offsets guardados
+RTC_DATA_ATTR int syncSiguiente = 0;                    ///< Posición del próximo offset en el anillo
+RTC_DATA_ATTR uint32_t syncUltimaUnix = 0;              ///< Último intento de sincronización
+TaskHandle_t tareaSincronizacionHandle = NULL;          ///< Destino de la notificación de respuesta
+int64_t syncEco = 0;                                    ///< t1 devuelto por el host
+int64_t syncT2 = 0;                                     ///< Recepción de la petición en el host (ms)
+int64_t syncT3 = 0;                                     ///< Envío de la respuesta en el host (ms)
+uint32_t syncLlegadaMs = 0;                             ///< millis() al recibir la respuesta
+uint32_t syncIntercambios = 0;                          ///< Respuestas válidas recibidas
+uint32_t syncRechazados = 0;                            ///< Intercambios descartados por retardo
+uint32_t syncSinRespuesta = 0;                          ///< Peticiones sin respuesta a tiempo
+int32_t syncUltimoRetardoMs = 0;                        ///< Retardo del último offset aceptado
+
+/**
+ * @brief Recoge una respuesta "R<t1> <t2> <t3>" del host y despierta a tareaSincronizacion
+ * 
+ * llegadaMs es el millis() en que se completó la línea (t4 se calcula con él).
+ */
+void syncRecibir(const char *linea, uint32_t llegadaMs) {
+  char *fin;
+  int64_t t1 = strtoll(&linea[1], &fin, 10);
+  int64_t t2 = strtoll(fin, &fin, 10);
+  int64_t t3 = strtoll(fin, NULL, 10);
+  if (tareaSincronizacionHandle == NULL) return;
+  syncEco = t1;
+  syncT2 = t2;
+  syncT3 = t3;
+  syncLlegadaMs = llegadaMs;
+  xTaskNotifyGive(tareaSincronizacionHandle);
+}
+
 /**
- * @brief Tarea para controlar el LED de alarma
+ * @brief Espera al siguiente cambio de segundo del DS3231
  * 
- * Esta tarea:
- * 1. Espera indefinidamente al semáforo ledSemaphore
- * 2. Cuando lo recibe:
- *    - Enciende el LED por 500ms
- *    - Lo apaga
+ * Devuelve el nuevo unixtime y deja en millisFase el millis() del cambio, así
+ * la hora del DS3231 se conoce con resolución de ms durante el intercambio.
+ */
+uint32_t syncFase(uint32_t &millisFase) {
+  uint32_t segundo = relojCrudo().unixtime();
+  uint32_t ahora;
+  while ((ahora = relojCrudo().unixtime()) == segundo) vTaskDelay(pdMS_TO_TICKS(2));
+  millisFase = millis();
+  return ahora;
+}
+
+/**
+ * @brief Hace un intercambio con el host y calcula offset y retardo
  * 
- * Comunicación:
- * - Consumidor del semáforo ledSemaphore(se usa un semanforo binario libre-ocupado)
- * - No produce datos para otras tareas
+ * El dispositivo envía "S<t1>" y el host responde "R<t1> <t2> <t3>" con su
+ * hora de recepción y de envío; t4 es la llegada de la respuesta. t1 y t4
+ * están en la escala del DS3231 y t2 y t3 en la del host (ms):
+ * offset = ((t2 - t1) + (t3 - t4)) / 2, retardo = (t4 - t1) - (t3 - t2).
+ */
+bool syncIntercambio(uint32_t fase, uint32_t millisFase, int32_t &offsetMs, int32_t &retardoMs) {
+  int64_t t1 = (int64_t)fase * 1000 + (int32_t)(millis() - millisFase);
+  ulTaskNotifyTake(pdTRUE, 0);
+  xSemaphoreTake(enlaceMutex, portMAX_DELAY);
+  Serial.printf("S%lld\n", (long long)t1);
+  xSemaphoreGive(enlaceMutex);
+  if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SYNC_ESPERA_MS)) == 0 || syncEco != t1) {
+    syncSinRespuesta++;
+    return false;
+  }
+  int64_t t4 = (int64_t)fase * 1000 + (int32_t)(syncLlegadaMs - millisFase);
+  syncIntercambios++;
+  retardoMs = (int32_t)((t4 - t1) - (syncT3 - syncT2));
+  offsetMs = (int32_t)(((syncT2 - t1) + (syncT3 - t4)) / 2);
+  return true;
+}
+
+/**
+ * @brief Estima offset y deriva por mínimos cuadrados sobre los offsets guardados
  * 
- * Sincronización:
- * - Se bloquea hasta que tareaMostrar libera el semáforo
- * - Prioridad más alta para respuesta rápida
+ * El offset se refiere al instante del offset más reciente. Con un solo
+ * offset (o todos en el mismo segundo) la deriva se deja como estaba.
  */
-void tareaAlarma(void *pvParameters) {
-  while (1) {
-    if (xSemaphoreTake(ledSemaphore, portMAX_DELAY) == pdPASS) {
-      digitalWrite(LED_PIN, HIGH);
-      vTaskDelay(pdMS_TO_TICKS(500));
-      digitalWrite(LED_PIN, LOW);
-    }
+void syncAjustar() {
+  int ultimo = (syncSiguiente + SYNC_MUESTRAS - 1) % SYNC_MUESTRAS;
+  uint32_t ref = syncMuestraUnix[ultimo];
+  double sumaX = 0, sumaY = 0;
+  for (int i = 0; i < syncNumMuestras; i++) {
+    sumaX += (int32_t)(syncMuestraUnix[i] - ref);
+    sumaY += syncMuestraMs[i];
   }
+  double mediaX = sumaX / syncNumMuestras;
+  double mediaY = sumaY / syncNumMuestras;
+  double sxy = 0, sxx = 0;
+  for (int i = 0; i < syncNumMuestras; i++) {
+    double dx = (int32_t)(syncMuestraUnix[i] - ref) - mediaX;
+    sxy += dx * (syncMuestraMs[i] - mediaY);
+    sxx += dx * dx;
+  }
+  double pendiente = sxx > 0 ? sxy / sxx : syncDerivaPpb / 1e6;  // ms por s
+  syncRefUnix = ref;
+  syncOffsetMs = (int32_t)lround(mediaY - pendiente * mediaX);
+  syncDerivaPpb = (int32_t)lround(pendiente * 1e6);
+  syncValida = true;
 }
 
 /**
- * @brief Tarea para crear tramas formateadas
+ * @brief Tarea de sincronización de hora con el host
  * 
  * Esta tarea:
- * 1. Mantiene últimos valores válidos de temperatura/humedad
- * 2. Recibe datos de sensores 
- * 3. Recibe datos del RTC 
- * 4. Cuando tiene todos los datos, crea una trama:
- *    "DD/MM/AAAA HH:MM:SS, Temp: X.XX C, Hum: XX.XX%, Luz: XXXX"
- * 5. Envía la trama a tramaQueue
+ * 1. Espera a que termine el backfill inicial (el enlace está ocupado)
+ * 2. Cada SYNC_PERIODO_S (medido en el DS3231, así cuenta también el
+ *    tiempo en Deep Sleep) fija la fase del segundo del DS3231 y hace
+ *    SYNC_INTENTOS intercambios con el host
+ * 3. Se queda con el de menor retardo si no supera SYNC_RETARDO_MAX_MS (el
+ *    error del offset está acotado por la mitad del retardo)
+ * 4. Guarda el offset en memoria RTC y reestima offset y deriva, que
+ *    relojAhora aplica a cada lectura del DS3231
  * 
  * Comunicación:
- * - Consumidor de sensorQueue y rtcQueue
- * - Productor de tramaQueue
+ * - Escribe peticiones en el enlace (con enlaceMutex)
+ * - tareaEnlaceRx le notifica las respuestas
  */
-void tareaCrearTrama(void *pvParameters) {
-  SensorData sensorData;
-  RTCData rtcData;
-  char trama[100];
-  
-  static float lastTemperature = -1;
-  static float lastHumidity = -1;
+void tareaSincronizacion(void *pvParameters) {
+  while (backfillActivo) vTaskDelay(pdMS_TO_TICKS(100));
 
   while (1) {
-    // Actualizar últimos valores de sensores
-    if (xQueueReceive(sensorQueue, &sensorData, pdMS_TO_TICKS(1000)) == pdPASS) {
-      if (sensorData.temperature != -1) lastTemperature = sensorData.temperature;
-      if (sensorData.humidity != -1) lastHumidity = sensorData.humidity;
-    }
-
-    // Cuando hay datos del RTC, crear trama completa
-    if (xQueueReceive(rtcQueue, &rtcData, pdMS_TO_TICKS(1000)) == pdPASS) {
-      snprintf(trama, sizeof(trama), 
-               "%02d/%02d/%04d %02d:%02d:%02d, Temp: %.2f C, Hum: %.2f%%, Luz: %d",
-               rtcData.day, rtcData.month, rtcData.year,
-               rtcData.hour, rtcData.minute, rtcData.second,
-               lastTemperature, lastHumidity, sensorData.light);
-
-      xQueueSend(tramaQueue, &trama, portMAX_DELAY);
+    uint32_t ahora = relojCrudo().unixtime();
+    if (syncUltimaUnix == 0 || (int32_t)(ahora - syncUltimaUnix) >= SYNC_PERIODO_S) {
+      syncUltimaUnix = ahora;
+      uint32_t millisFase;
+      uint32_t fase = syncFase(millisFase);
+      int32_t mejorOffset = 0;
+      int32_t mejorRetardo = INT32_MAX;
+      for (int i = 0; i < SYNC_INTENTOS; i++) {
+        int32_t offsetMs, retardoMs;
+        if (!syncIntercambio(fase, millisFase, offsetMs, retardoMs)) continue;
+        if (retardoMs < 0 || retardoMs > SYNC_RETARDO_MAX_MS) {
+          syncRechazados++;
+        } else if (retardoMs < mejorRetardo) {
+          mejorOffset = offsetMs;
+          mejorRetardo = retardoMs;
+        }
+      }
+      if (mejorRetardo != INT32_MAX) {
+        syncMuestraUnix[syncSiguiente] = fase;
+        syncMuestraMs[syncSiguiente] = mejorOffset;
+        syncSiguiente = (syncSiguiente + 1) % SYNC_MUESTRAS;
+        if (syncNumMuestras < SYNC_MUESTRAS) syncNumMuestras++;
+        syncUltimoRetardoMs = mejorRetardo;
+        syncAjustar();
+      }
     }
-    
-    vTaskDelay(pdMS_TO_TICKS(5000));
+    vTaskDelay(pdMS_TO_TICKS(1000));
   }
 }
 
 /**
- * @brief Tarea para mostrar tramas formateadas
+ * @brief Muestra por serial el estado de la sincronización de hora
+ */
+void syncReportar() {
+  Serial.printf("SYNC intercambios %lu rechazados %lu sin_respuesta %lu | offset %ld ms "
+                "deriva %ld ppb retardo %ld ms muestras %d\n",
+                (unsigned long)syncIntercambios, (unsigned long)syncRechazados,
+                (unsigned long)syncSinRespuesta, (long)syncOffsetMs, (long)syncDerivaPpb,
+                (long)syncUltimoRetardoMs, syncNumMuestras);
+}
+
+/**
+ * @brief Tarea para recibir comandos del host por el enlace serie
  * 
  * Esta tarea:
- * 1. Espera tramas de tramaQueue
- * 2. Las muestra por el puerto serial
- * 3. Se ejecuta cada 5 segundos
+ * 1. Espera a que termine el backfill inicial (que lee el serial por su cuenta)
+ * 2. Lee líneas "A<seq>" y "N<seq>" y las envía a enlaceQueue para que
+ *    tareaMostrarTrama las procese (un host que confirma lee texto)
+ * 3. Con "C1" / "C0" conecta o desconecta la consola de texto
+ * 4. Pasa las respuestas de hora "R<t1> <t2> <t3>" a tareaSincronizacion
  * 
  * Comunicación:
- * - Consumidor de tramaQueue
- * - No produce datos para otras tareas
+ * - Productor de enlaceQueue
  */
-void tareaMostrarTrama(void *pvParameters) {
-  char trama[100];
+void tareaEnlaceRx(void *pvParameters) {
+  char linea[48];
+
+  while (backfillActivo) vTaskDelay(pdMS_TO_TICKS(100));
 
   while (1) {
-    if (xQueueReceive(tramaQueue, &trama, portMAX_DELAY) == pdPASS) {
-      Serial.println(trama);
+    if (!leerLineaEnlace(linea, sizeof(linea), portMAX_DELAY)) continue;
+    if (linea[0] == 'A' || linea[0] == 'N') {
+      consolaConectada = true;
+      EventoEnlace evento = {linea[0], (uint32_t)strtoul(&linea[1], NULL, 10)};
+      xQueueSend(enlaceQueue, &evento, portMAX_DELAY);
+    } else if (linea[0] == 'C') {
+      consolaConectada = linea[1] == '1';
+    } else if (linea[0] == 'R') {
+      syncRecibir(linea, millis());
     }
-    vTaskDelay(pdMS_TO_TICKS(5000));
   }
 }
 
@@ -296,12 +3211,23 @@ void IRAM_ATTR buttonISR() {
   }
 }
 
+/**
+ * @brief ISR del loopback de medida de latencia
+ * 
+ * LOOPBACK_PIN está cableado a LED_PIN; el flanco de subida marca el
+ * instante en que el LED se enciende realmente.
+ */
+void IRAM_ATTR loopbackISR() {
+  loopbackFlancoUs = micros();
+}
+
 /**
  * @brief Tarea para mostrar el contador de pulsaciones
  * 
  * Esta tarea:
  * 1. Muestra el valor del contador por serial cada segundo
  * 2. Usa variable contador marcada como RTC_DATA_ATTR
+ * 3. Se despierta en la rejilla del coordinador de muestreo
  * 
  * Comunicación:
  * - Accede a variable global compartida (contador)
@@ -309,10 +3235,48 @@ void IRAM_ATTR buttonISR() {
  */
 void tareaMostrarContador(void *pvParameters) {
   while (1) {
-    Serial.print("Contador: ");
-    Serial.println(contador);
-    vTaskDelay(pdMS_TO_TICKS(1000));
+    if (!backfillActivo) {
+      xSemaphoreTake(enlaceMutex, portMAX_DELAY);
+      Serial.print("Contador: ");
+      Serial.println(contador);
+      xSemaphoreGive(enlaceMutex);
+    }
+    muestreoEsperar(1000);
+  }
+}
+
+/**
+ * @brief Mide el desfase entre el despertar real y el previsto
+ * 
+ * Esta función:
+ * 1. Espera al siguiente cambio de segundo del DS3231 para conocer la fase
+ *    exacta del reloj (tarda como mucho 1 s)
+ * 2. Calcula la hora de pared del arranque: segundo actual - millis()
+ * 3. Acumula en memoria RTC el desfase respecto a despertarObjetivo y lo muestra
+ * 
+ * Nota:
+ * - Solo se usa con MEDIR_JITTER_DESPERTAR, tras despertar de Deep Sleep
+ * - El tiempo de arranque del ESP32 se incluye en el desfase (es casi constante)
+ */
+void medirJitterDespertar() {
+  uint8_t segundo = relojAhora().second();
+  DateTime ahora = relojAhora();
+  while (ahora.second() == segundo) {
+    delay(1);
+    ahora = relojAhora();
   }
+  int64_t arranqueMs = (int64_t)ahora.unixtime() * 1000 - millis();
+  int32_t desfaseMs = (int32_t)(arranqueMs - (int64_t)despertarObjetivo * 1000);
+
+  jitterMuestras++;
+  jitterSumaMs += desfaseMs;
+  if (desfaseMs < jitterMinMs) jitterMinMs = desfaseMs;
+  if (desfaseMs > jitterMaxMs) jitterMaxMs = desfaseMs;
+
+  Serial.printf("Despertar (%s): desfase %ld ms, min %ld, max %ld, media %ld en %lu muestras\n",
+                DESPERTAR_POR_ALARMA_RTC ? "alarma DS3231" : "timer ESP32",
+                (long)desfaseMs, (long)jitterMinMs, (long)jitterMaxMs,
+                (long)(jitterSumaMs / jitterMuestras), (unsigned long)jitterMuestras);
 }
 
 /**
@@ -320,36 +3284,444 @@ void tareaMostrarContador(void *pvParameters) {
  * 
  * Esta función:
  * 1. Configura fuente de wakeup:
- *    - timer: Después de 30 segundos
- * 2. Inicia el modo Deep Sleep
+ *    - timer: Después de PERIODO_SLEEP_S segundos
+ *    - alarma DS3231 (DESPERTAR_POR_ALARMA_RTC): en el siguiente múltiplo de
+ *      PERIODO_SLEEP_S de la hora de pared que quede al menos ALARMA_MARGEN_S
+ *      por delante, por la línea INT/SQW mediante ext0. El timer del ESP32
+ *      queda de respaldo ALARMA_RESPALDO_S después: si la alarma se perdiera,
+ *      con coincidencia de fecha no volvería a saltar hasta el mes siguiente
+ * 2. Hace commit del grupo pendiente del WAL y vacía las salidas con tarea
+ *    propia (sinksVaciar), antes de los informes para que cuenten lo entregado
+ * 3. Con REPORTES_ACTIVOS y consola conectada, escribe los informes de una
+ *    vez bajo enlaceMutex; un equipo sin consola no formatea ninguno
+ * 4. Inicia el modo Deep Sleep
  * 
  * Nota:
  * - Las variables marcadas con RTC_DATA_ATTR se preservan
+ * - Las tramas aún en tramaBuffer se reproducen desde el WAL al despertar
+ * - Con la alarma del DS3231 todos los equipos despiertan en los mismos
+ *   instantes de pared y el timer RTC del ESP32 no necesita estar alimentado
  * - El consumo de energía se reduce
+ * - Se llama desde GestionSleep, que necesita 4096 bytes de pila: el commit
+ *   usa LittleFS y los informes usan printf con coma flotante y NVS
  */
 void enterDeepSleep() {
-    Serial.println("Entrando en Deep Sleep...");
-    esp_sleep_enable_timer_wakeup(30 * 1000000);
+    xSemaphoreTake(walMutex, portMAX_DELAY);
+    walCommit();
+    xSemaphoreGive(walMutex);
+    sinksVaciar(1000);
+#if PRESUPUESTO_ACTIVO
+    presupuestoGuardarPicos();
+#endif
+#if REPORTES_ACTIVOS
+    if (consolaConectada) {
+      xSemaphoreTake(enlaceMutex, portMAX_DELAY);
+      Serial.println("Entrando en Deep Sleep...");
+      Serial.printf("ARQ: enviadas %lu, retransmitidas %lu\n",
+                    (unsigned long)arqEnviadas, (unsigned long)arqRetransmitidas);
+      Serial.printf("WAL: sin durabilidad %lu (WAL lleno, límite %lu bytes)\n",
+                    (unsigned long)walDescartes, (unsigned long)WAL_MAX_BYTES);
+      muestreoReportar();
+      sinksReportar();
+      cuantizacionReportar();
+      joinReportar();
+      syncReportar();
+      cargaReportar();
+#if PERFIL_COLAS
+      perfilReportar();
+#endif
+#if HUELLA_MEMORIA
+      if (huellaReportar() > 0 && HUELLA_ESTRICTA) {
+        Serial.flush();
+        abort();
+      }
+#endif
+      latenciaReportar("Latencia muestra -> LED", latenciaSoftware);
+      latenciaReportar("Latencia muestra -> flanco (loopback)", latenciaLoopback);
+      if (alarmaDespertares > 0) {
+        Serial.printf("Alarma (%s): señal -> despertar min %lu, media %lu, max %lu us, acumuladas %lu\n",
+                      ALARMA_CON_SEMAFORO ? "semáforo" : "notificación",
+                      (unsigned long)alarmaDespertarMin,
+                      (unsigned long)(alarmaDespertarSuma / alarmaDespertares),
+                      (unsigned long)alarmaDespertarMax, (unsigned long)alarmaAcumuladas);
+      }
+      if (alarmaEventosEnviados > 0) {
+        Serial.printf("Alarmas: %lu eventos, latencia media %lu us, máxima %lu us\n",
+                      (unsigned long)alarmaEventosEnviados,
+                      (unsigned long)(alarmaLatenciaSumaUs / alarmaEventosEnviados),
+                      (unsigned long)alarmaLatenciaMaxUs);
+      }
+      xSemaphoreGive(enlaceMutex);
+    }
+#endif
+    uint32_t ahora = relojAhora().unixtime();
+#if DESPERTAR_POR_ALARMA_RTC
+    despertarObjetivo = (ahora / PERIODO_SLEEP_S + 1) * PERIODO_SLEEP_S;
+    if (despertarObjetivo - ahora < ALARMA_MARGEN_S) despertarObjetivo += PERIODO_SLEEP_S;
+    relojProgramarAlarma(despertarObjetivo - relojCorreccionS(despertarObjetivo));
+    rtc_gpio_pullup_en(RTC_INT_PIN);  // INT es de drenador abierto, activo a nivel bajo
+    rtc_gpio_pulldown_dis(RTC_INT_PIN);
+    esp_sleep_enable_ext0_wakeup(RTC_INT_PIN, 0);
+    esp_sleep_enable_timer_wakeup((uint64_t)(despertarObjetivo - ahora + ALARMA_RESPALDO_S) * 1000000);
+#else
+    despertarObjetivo = ahora + PERIODO_SLEEP_S;
+    esp_sleep_enable_timer_wakeup((uint64_t)PERIODO_SLEEP_S * 1000000);
+#endif
     esp_deep_sleep_start();
 }
 
+#if BENCH_TAREAS
+/**
+ * @brief Mide en ciclos de CPU el cuerpo de trabajo de cada tarea
+ * 
+ * Cada medida se repite BENCH_TAREAS_REPETICIONES veces y se reporta el
+ * mínimo, que es el valor más estable entre ejecuciones. La salida son
+ * líneas "BENCH_TAREA <nombre> <ciclos>" pensadas para guardarse por commit
+ * (en placa o en el emulador QEMU con SIMULAR_PERIFERICOS;
+ * herramientas/qemu_bench.sh compila, ejecuta y guarda el resultado). También
+ * comprueba que volver a empaquetar una trama decodificada da los mismos
+ * bytes (la cuantización es idempotente).
+ */
+void benchTareas() {
+  RTCData rtcData = {12, 34, 56, 18, 10, 2026, 2450, 0};
+  char trama[TRAMA_MAX];
+  uint8_t empaquetada[CodificadorTrama::BYTES];
+  TramaBinaria binaria = tramaEmpaquetar(rtcData, 24.5f, 61.25f, 512);
+  uint8_t bloque[BACKFILL_BLOQUE];
+  memset(bloque, 0xA5, sizeof(bloque));
+  fftIniciarTablas();
+
+  struct Medida {
+    const char *nombre;
+    uint32_t minimo;
+  } medidas[] = {
+    {"formatear_trama", UINT32_MAX},
+    {"lectura_dht", UINT32_MAX},
+    {"lectura_luz", UINT32_MAX},
+    {"lectura_rtc", UINT32_MAX},
+    {"fusion_dht", UINT32_MAX},
+    {"fft_bloque", UINT32_MAX},
+    {"crc16_bloque", UINT32_MAX},
+    {"codificar_trama", UINT32_MAX},
+    {"decodificar_trama", UINT32_MAX},
+  };
+
+  for (int r = 0; r < BENCH_TAREAS_REPETICIONES; r++) {
+    uint32_t t0 = ESP.getCycleCount();
+    formatearTrama(trama, sizeof(trama), r, tramaEmpaquetar(rtcData, 24.5f, 61.25f, 512));
+    uint32_t t1 = ESP.getCycleCount();
+    leerTemperaturaDht();
+    leerHumedadDht();
+    uint32_t t2 = ESP.getCycleCount();
+    leerLuz();
+    uint32_t t3 = ESP.getCycleCount();
+    relojAhora();
+    leerTemperaturaRtc();
+    uint32_t t4 = ESP.getCycleCount();
+    fusionActualizarDht(24.5f);
+    uint32_t t5 = ESP.getCycleCount();
+    fftQ15(parpadeoRe, parpadeoIm, PARPADEO_MUESTRAS);
+    uint32_t t6 = ESP.getCycleCount();
+    crc16(bloque, sizeof(bloque));
+    uint32_t t7 = ESP.getCycleCount();
+    tramaCodificar(binaria, empaquetada);
+    uint32_t t8 = ESP.getCycleCount();
+    TramaBinaria decodificada = tramaDecodificar(empaquetada);
+    uint32_t t9 = ESP.getCycleCount();
+    uint8_t reempaquetada[CodificadorTrama::BYTES];
+    tramaCodificar(decodificada, reempaquetada);
+    if (memcmp(reempaquetada, empaquetada, sizeof(empaquetada)) != 0) {
+      Serial.println("BENCH_TAREA error: la trama empaquetada no sobrevive a la ida y vuelta");
+    }
+
+    uint32_t ciclos[] = {t1 - t0, t2 - t1, t3 - t2, t4 - t3, t5 - t4, t6 - t5, t7 - t6, t8 - t7, t9 - t8};
+    for (size_t i = 0; i < sizeof(ciclos) / sizeof(ciclos[0]); i++) {
+      medidas[i].minimo = min(medidas[i].minimo, ciclos[i]);
+    }
+  }
+
+  for (const Medida &m : medidas) {
+    Serial.printf("BENCH_TAREA %s %lu\n", m.nombre, (unsigned long)m.minimo);
+  }
+}
+#endif
+
+#if BENCH_COLAS
+/**
+ * @class AnilloSpsc
+ * @brief Anillo sin bloqueos de un productor y un consumidor
+ * 
+ * Cada extremo solo escribe su propio índice, así que basta con atómicos con
+ * orden acquire/release. Si el anillo está vacío, recibir() se bloquea en la
+ * notificación que envía el productor.
+ */
+template <size_t Ranuras, size_t TamRanura>
+class AnilloSpsc {
+public:
+  TaskHandle_t receptor = NULL;  ///< Tarea a notificar al escribir (NULL: no notificar)
+
+  bool enviar(const void *datos, size_t len) {
+    uint32_t cabeza = cabeza_.load(std::memory_order_relaxed);
+    if (cabeza - cola_.load(std::memory_order_acquire) == Ranuras) return false;
+    memcpy(ranuras_[cabeza % Ranuras], datos, len);
+    cabeza_.store(cabeza + 1, std::memory_order_release);
+    if (receptor) xTaskNotifyGive(receptor);
+    return true;
+  }
+
+  bool recibir(void *datos, size_t len, TickType_t espera) {
+    uint32_t cola = cola_.load(std::memory_order_relaxed);
+    while (cabeza_.load(std::memory_order_acquire) == cola) {
+      if (espera == 0 || ulTaskNotifyTake(pdTRUE, espera) == 0) return false;
+    }
+    memcpy(datos, ranuras_[cola % Ranuras], len);
+    cola_.store(cola + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  std::atomic<uint32_t> cabeza_{0};
+  std::atomic<uint32_t> cola_{0};
+  uint8_t ranuras_[Ranuras][TamRanura];
+};
+
+/**
+ * @brief Adaptadores con la misma interfaz para cada primitiva medida
+ * 
+ * crear(tam) prepara el canal para mensajes de tam bytes, receptor es la
+ * tarea que consume (solo lo usan los canales basados en notificaciones).
+ */
+struct CanalCola {
+  static constexpr const char *nombre = "cola";
+  QueueHandle_t h;
+  TaskHandle_t receptor = NULL;
+  void crear(size_t tam) { h = xQueueCreate(4, tam); }
+  void destruir() { vQueueDelete(h); }
+  bool enviar(const void *p, size_t tam) { return xQueueSend(h, p, portMAX_DELAY) == pdPASS; }
+  bool recibir(void *p, size_t tam, TickType_t t) { return xQueueReceive(h, p, t) == pdPASS; }
+};
+
+struct CanalStreamBuffer {
+  static constexpr const char *nombre = "stream_buffer";
+  StreamBufferHandle_t h;
+  TaskHandle_t receptor = NULL;
+  void crear(size_t tam) { h = xStreamBufferCreate(4 * tam, tam); }
+  void destruir() { vStreamBufferDelete(h); }
+  bool enviar(const void *p, size_t tam) { return xStreamBufferSend(h, p, tam, portMAX_DELAY) == tam; }
+  bool recibir(void *p, size_t tam, TickType_t t) { return xStreamBufferReceive(h, p, tam, t) == tam; }
+};
+
+struct CanalMessageBuffer {
+  static constexpr const char *nombre = "message_buffer";
+  MessageBufferHandle_t h;
+  TaskHandle_t receptor = NULL;
+  void crear(size_t tam) { h = xMessageBufferCreate(4 * (tam + sizeof(size_t))); }
+  void destruir() { vMessageBufferDelete(h); }
+  bool enviar(const void *p, size_t tam) { return xMessageBufferSend(h, p, tam, portMAX_DELAY) == tam; }
+  bool recibir(void *p, size_t tam, TickType_t t) { return xMessageBufferReceive(h, p, tam, t) == tam; }
+};
+
+struct CanalNotificacion {
+  static constexpr const char *nombre = "notificacion";
+  uint8_t ranura[TRAMA_MAX];  ///< Una sola ranura compartida; la notificación marca que está llena
+  TaskHandle_t receptor = NULL;
+  void crear(size_t tam) {}
+  void destruir() {}
+  bool enviar(const void *p, size_t tam) {
+    memcpy(ranura, p, tam);
+    return xTaskNotifyGive(receptor) == pdPASS;
+  }
+  bool recibir(void *p, size_t tam, TickType_t t) {
+    if (ulTaskNotifyTake(pdTRUE, t) == 0) return false;
+    memcpy(p, ranura, tam);
+    return true;
+  }
+};
+
+struct CanalAnillo {
+  static constexpr const char *nombre = "anillo_spsc";
+  AnilloSpsc<4, TRAMA_MAX> anillo;
+  TaskHandle_t receptor = NULL;
+  void crear(size_t tam) { anillo.receptor = receptor; }
+  void destruir() {}
+  bool enviar(const void *p, size_t tam) { return anillo.enviar(p, tam); }
+  bool recibir(void *p, size_t tam, TickType_t t) { return anillo.recibir(p, tam, t); }
+};
+
+/**
+ * @struct BenchPingPong
+ * @brief Estado compartido entre la tarea de benchmark y su tarea eco
+ */
+template <typename Canal>
+struct BenchPingPong {
+  Canal ida;                ///< Benchmark -> eco
+  Canal vuelta;             ///< Eco -> benchmark
+  size_t tam;               ///< Bytes por mensaje
+  SemaphoreHandle_t fin;    ///< La tarea eco terminó
+};
+
+/**
+ * @brief Tarea eco: devuelve cada mensaje recibido por el canal de vuelta
+ */
+template <typename Canal>
+void tareaBenchEco(void *pvParameters) {
+  BenchPingPong<Canal> *pp = (BenchPingPong<Canal> *)pvParameters;
+  uint8_t buffer[TRAMA_MAX];
+  ulTaskNotifyTake(pdFALSE, portMAX_DELAY);  // Esperar a que los canales estén creados
+  for (int i = 0; i < BENCH_ITERACIONES; i++) {
+    pp->ida.recibir(buffer, pp->tam, portMAX_DELAY);
+    pp->vuelta.enviar(buffer, pp->tam);
+  }
+  xSemaphoreGive(pp->fin);
+  vTaskDelete(NULL);
+}
+
+/**
+ * @brief Mide una primitiva con mensajes de tam bytes
+ * 
+ * Esta función:
+ * 1. Misma tarea: enviar + recibir sin cambio de contexto -> ciclos por
+ *    transferencia y transferencias por segundo (coste puro de la primitiva)
+ * 2. Ping-pong con una tarea eco en el mismo núcleo -> latencia de una
+ *    transferencia con despertar de la tarea receptora (ida y vuelta / 2)
+ * 
+ * Imprime una línea "BENCH" por medida para poder comparar ejecuciones.
+ */
+template <typename Canal>
+void benchPrimitiva(size_t tam) {
+  uint8_t mensaje[TRAMA_MAX];
+  memset(mensaje, 0x5A, sizeof(mensaje));
+  uint32_t mhz = getCpuFrequencyMhz();
+
+  // 1. Misma tarea (se limpian antes las notificaciones que quedaran pendientes)
+  ulTaskNotifyTake(pdTRUE, 0);
+  Canal *canal = new Canal();
+  canal->receptor = xTaskGetCurrentTaskHandle();
+  canal->crear(tam);
+  uint32_t inicio = ESP.getCycleCount();
+  for (int i = 0; i < BENCH_ITERACIONES; i++) {
+    canal->enviar(mensaje, tam);
+    canal->recibir(mensaje, tam, 0);
+  }
+  uint32_t ciclos = (ESP.getCycleCount() - inicio) / BENCH_ITERACIONES;
+  canal->destruir();
+  delete canal;
+
+  // 2. Ping-pong entre tareas
+  ulTaskNotifyTake(pdTRUE, 0);
+  BenchPingPong<Canal> *pp = new BenchPingPong<Canal>();
+  pp->tam = tam;
+  pp->fin = xSemaphoreCreateBinary();
+  TaskHandle_t eco;
+  xTaskCreatePinnedToCore(tareaBenchEco<Canal>, "BenchEco", 2048, pp, 1, &eco, xPortGetCoreID());
+  pp->ida.receptor = eco;
+  pp->vuelta.receptor = xTaskGetCurrentTaskHandle();
+  pp->ida.crear(tam);
+  pp->vuelta.crear(tam);
+  xTaskNotifyGive(eco);
+  uint32_t inicioPp = ESP.getCycleCount();
+  for (int i = 0; i < BENCH_ITERACIONES; i++) {
+    pp->ida.enviar(mensaje, tam);
+    pp->vuelta.recibir(mensaje, tam, portMAX_DELAY);
+  }
+  uint32_t ciclosPp = (ESP.getCycleCount() - inicioPp) / (2 * BENCH_ITERACIONES);
+  xSemaphoreTake(pp->fin, portMAX_DELAY);
+  pp->ida.destruir();
+  pp->vuelta.destruir();
+  vSemaphoreDelete(pp->fin);
+  delete pp;
+
+  Serial.printf("BENCH %-14s %3u B | misma tarea: %5lu ciclos, %7lu ops/s | entre tareas: %5lu ciclos, %4lu us\n",
+                Canal::nombre, (unsigned)tam,
+                (unsigned long)ciclos, (unsigned long)(mhz * 1000000UL / max(ciclos, (uint32_t)1)),
+                (unsigned long)ciclosPp, (unsigned long)(ciclosPp / mhz));
+}
+
+/**
+ * @brief Mide todas las primitivas con un tamaño de mensaje
+ */
+void benchTamano(size_t tam) {
+  benchPrimitiva<CanalCola>(tam);
+  benchPrimitiva<CanalStreamBuffer>(tam);
+  benchPrimitiva<CanalMessageBuffer>(tam);
+  benchPrimitiva<CanalNotificacion>(tam);
+  benchPrimitiva<CanalAnillo>(tam);
+}
+
+/**
+ * @brief Tarea de benchmark de primitivas de comunicación
+ * 
+ * Mide colas, stream buffers, message buffers, notificaciones directas y un
+ * anillo SPSC propio con los tamaños reales del sistema: SensorData, RTCData
+ * y una trama de texto típica de 100 bytes. Se ejecuta una vez y termina.
+ */
+void tareaBenchColas(void *pvParameters) {
+  Serial.printf("BENCH inicio: %lu MHz, %d iteraciones\n",
+                (unsigned long)getCpuFrequencyMhz(), BENCH_ITERACIONES);
+  benchTamano(sizeof(SensorData));
+  benchTamano(sizeof(RTCData));
+  benchTamano(100);
+  Serial.println("BENCH fin");
+  vTaskDelete(NULL);
+}
+#endif
+
+/**
+ * @brief Muestra los buffers de tamaño fijo que no entran en el presupuesto
+ * 
+ * Se dimensionan en compilación y no se pueden repartir, así que quedan fuera
+ * de PRESUPUESTO_BYTES; se listan junto a las partidas para que el informe
+ * MEMORIA cubra toda la RAM estática del pipeline.
+ */
+void memoriaFijaReportar() {
+  struct BufferFijo {
+    const char *nombre;
+    size_t bytes;
+  } fijos[] = {
+    {"walGrupo", sizeof(walGrupo)},
+    {"arqVentana", sizeof(arqVentana)},
+    {"arqArena", sizeof(arqArena)},
+    {"joinCanales", sizeof(joinDht) + sizeof(joinLuz)},
+    {"joinTicks", sizeof(joinTicks)},
+    {"parpadeo", sizeof(parpadeoRe) + sizeof(parpadeoIm)},
+    {"fftTablas", sizeof(fftCos) + sizeof(fftSin)},
+  };
+  size_t total = 0;
+  for (const BufferFijo &b : fijos) {
+    Serial.printf("MEMORIA fijo %s bytes %u\n", b.nombre, (unsigned)b.bytes);
+    total += b.bytes;
+  }
+  Serial.printf("MEMORIA fijo total %u\n", (unsigned)total);
+}
+
 /**
  * @brief Función de configuración inicial
  * 
  * Esta función:
- * 1. Inicializa periféricos (Serial, DHT, I2C, RTC)
+ * 1. Inicializa periféricos (Serial, DHT, I2C, RTC, LittleFS)
  * 2. Configura pines (LED, botones)
  * 3. Configura interrupciones para los botones
  * 4. Crea colas y semáforos
- * 5. Crea todas las tareas de FreeRTOS
- * 6. Inicia el contador de reinicios
+ * 5. Reproduce las tramas pendientes del WAL (como texto o mediante backfill)
+ * 6. Crea todas las tareas de FreeRTOS
+ * 7. Inicia el contador de reinicios
  */
 void setup() {
   Serial.begin(115200);
+  Serial.onReceive(enlaceDatosRecibidos);
+
+#if BENCH_COLAS
+  xTaskCreatePinnedToCore(tareaBenchColas, "BenchColas", 4096, NULL, 1, NULL, ARDUINO_RUNNING_CORE);
+  return;
+#endif
+
   dht.begin();
   Wire.begin();
 
   // Inicialización RTC
+#if SIMULAR_PERIFERICOS
+  Serial.println("Periféricos simulados (DHT11, LDR, DS3231)");
+#else
   if (!rtc.begin()) {
     Serial.println("No se encontró RTC");
     while (1);
@@ -359,6 +3731,32 @@ void setup() {
     Serial.println("RTC perdió la hora, estableciendo nueva hora...");
     rtc.adjust(DateTime(F(__DATE__), F(__TIME__)));
   }
+#endif
+
+  // Despertar por alarma del DS3231: liberar la línea INT
+  if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_EXT0) {
+    relojLiberarAlarma();
+  }
+#if DESPERTAR_POR_ALARMA_RTC
+  if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER) {
+    Serial.println("Despertar por el timer de respaldo: la alarma del DS3231 no llegó");
+    relojLiberarAlarma();
+  }
+#endif
+#if MEDIR_JITTER_DESPERTAR
+  if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_UNDEFINED) {
+    medirJitterDespertar();
+  }
+#endif
+
+  nvsMutex = xSemaphoreCreateMutex();
+  secuenciaIniciar();
+
+  // Inicialización del WAL
+  walDisponible = LittleFS.begin(true);
+  if (!walDisponible) {
+    Serial.println("No se pudo montar LittleFS, WAL desactivado");
+  }
 
   // Configuración de pines
   pinMode(LED_PIN, OUTPUT);
@@ -368,36 +3766,128 @@ void setup() {
   // Configuración de interrupciones
   attachInterrupt(digitalPinToInterrupt(BUTTON_PIN_1), buttonISR, FALLING);
   attachInterrupt(digitalPinToInterrupt(BUTTON_PIN_2), buttonISR, FALLING);
+#if MEDIR_LATENCIA_LOOPBACK
+  pinMode(LOOPBACK_PIN, INPUT);
+  attachInterrupt(digitalPinToInterrupt(LOOPBACK_PIN), loopbackISR, RISING);
+#endif
+
+  // Presupuesto de memoria de colas y buffers
+  const uint16_t mensajeTrama = TRAMA_CABECERA_MSG + CodificadorTrama::BYTES + sizeof(size_t);
+  partidaDeclarar(PARTIDA_SENSOR, "sensorQueue", sizeof(SensorData), 2, SENSOR_COLA_LONGITUD, 3);
+  partidaDeclarar(PARTIDA_RTC, "rtcQueue", sizeof(RTCData), 1, RTC_COLA_LONGITUD, 2);
+  partidaDeclarar(PARTIDA_TRAMAS, "Serie", mensajeTrama, 2, TRAMA_BUFFER_BYTES / mensajeTrama, 3);
+  partidaDeclarar(PARTIDA_DIAG, "Diagnostico", mensajeTrama, 1, SINK_DIAG_BUFFER_BYTES / mensajeTrama, 1);
+  partidaDeclarar(PARTIDA_ENLACE, "enlaceQueue", sizeof(EventoEnlace), 2, ENLACE_COLA_LONGITUD, 2);
+  partidaDeclarar(PARTIDA_ALARMAS, "alarmaQueue", sizeof(EventoAlarma), 2, ALARMA_COLA_LONGITUD, 4);
+  partidaDeclarar(PARTIDA_JOIN, "joinQueue", sizeof(EventoJoin), 4, JOIN_COLA_LONGITUD, 3);
+#if PRESUPUESTO_ACTIVO
+  presupuestoRepartir();
+#if REPORTES_ACTIVOS
+  if (consolaConectada) memoriaFijaReportar();
+#endif
+#endif
 
   // Creación de objetos FreeRTOS
-  sensorQueue = xQueueCreate(10, sizeof(SensorData));
-  rtcQueue = xQueueCreate(5, sizeof(RTCData));
-  tramaQueue = xQueueCreate(5, sizeof(char[100]));
+  uint16_t longitudSensor = partidas[PARTIDA_SENSOR].asignado;
+  uint16_t longitudRtc = partidas[PARTIDA_RTC].asignado;
+  sensorQueue = xQueueCreate(longitudSensor, sizeof(SensorData));
+  rtcQueue = xQueueCreate(longitudRtc, sizeof(RTCData));
+  creditosSensor = xSemaphoreCreateCounting(longitudSensor, longitudSensor);
+  creditosRtc = xSemaphoreCreateCounting(longitudRtc, longitudRtc);
+  enlaceQueue = xQueueCreate(partidas[PARTIDA_ENLACE].asignado, sizeof(EventoEnlace));
+  alarmaQueue = xQueueCreate(partidas[PARTIDA_ALARMAS].asignado, sizeof(EventoAlarma));
+  joinQueue = xQueueCreate(partidas[PARTIDA_JOIN].asignado, sizeof(EventoJoin));
+  huellaAnotarCola("sensorQueue", partidaBytes(PARTIDA_SENSOR));
+  huellaAnotarCola("rtcQueue", partidaBytes(PARTIDA_RTC));
+  huellaAnotarCola("enlaceQueue", partidaBytes(PARTIDA_ENLACE));
+  huellaAnotarCola("alarmaQueue", partidaBytes(PARTIDA_ALARMAS));
+  huellaAnotarCola("joinQueue", partidaBytes(PARTIDA_JOIN));
+  enlaceMutex = xSemaphoreCreateMutex();
+#if ALARMA_CON_SEMAFORO
   ledSemaphore = xSemaphoreCreateBinary();
+#endif
+  walMutex = xSemaphoreCreateMutex();
 
-      // Creación de tareas
-    xTaskCreate(tareaMostrarContador, "MostrarContador", 1024, NULL, 1, NULL);
-    xTaskCreate(tareaDHT, "DHT11", 1024, NULL, 1, NULL);
-    xTaskCreate(tareaLDR, "LDR", 1024, NULL, 1, NULL);
-    xTaskCreate(tareaRTC, "RTC", 2048, NULL, 1, NULL);
-    xTaskCreate(tareaMostrar, "Mostrar", 2048, NULL, 1, NULL);
-    xTaskCreate(tareaAlarma, "Alarma", 1024, NULL, 2, NULL);
-    xTaskCreate(tareaCrearTrama, "CrearTrama", 2048, NULL, 1, NULL);
-    xTaskCreate(tareaMostrarTrama, "MostrarTrama", 2048, NULL, 1, NULL);
-
-    // Información de reinicio
+  // Salidas registradas sobre el flujo de tramas
+  sinkSerie = sinkRegistrar("Serie", REPRESENTACION_TEXTO, SINK_SERIE_PERIODO_MS, SINK_SERIE_LOTE,
+                            partidaBytes(PARTIDA_TRAMAS), NULL, NULL, &consolaConectada);
+  tramaBuffer = sinkSerie->buffer;
+#if SINK_DIAG_ACTIVO
+  sinkDiag = sinkRegistrar("Diagnostico", REPRESENTACION_BINARIA, SINK_DIAG_PERIODO_MS, SINK_DIAG_LOTE,
+                           partidaBytes(PARTIDA_DIAG), diagEscribir, diagFinLote,
+                           &metricasDerivadasActivas);
+#endif
+
+#if BENCH_TAREAS
+  benchTareas();
+#endif
+
+  // Tramas pendientes de la sesión anterior
+  uint32_t pendiente = 0;
+  if (walDisponible) {
+    uint32_t tam = walTamano();
+    if (walEntregado > tam) walEntregado = 0;
+    pendiente = tam - walEntregado;
+    if (pendiente >= BACKFILL_UMBRAL_BYTES) {
+      backfillActivo = true;
+    } else if (pendiente > 0) {
+      walReproducir(tam);
+    }
+  }
+
+    // Información de reinicio (antes de crear las tareas: con un backfill
+    // pendiente, después ya no se puede escribir texto en el enlace)
     wakeCounter++;
     Serial.print("Reinicio número: ");
     Serial.println(wakeCounter);
 
+      // Creación de tareas. tareaAlarma va primero: los productores la
+      // notifican por su handle, que no puede estar todavía a NULL
+    crearTarea(tareaAlarma, "Alarma", 1024, NULL, 2, &tareaAlarmaHandle);
+#if MUESTREO_ALINEADO
+    crearTarea(tareaCoordinadorMuestreo, "Coordinador", 2048, NULL, 2);
+#endif
+    crearTarea(tareaMostrarContador, "MostrarContador", 1024, NULL, 1);
+    crearTarea(tareaDHT, "DHT11", 2048, NULL, 1);
+    crearTarea(tareaLDR, "LDR", 2048, NULL, 1);
+    crearTarea(tareaRTC, "RTC", 2048, NULL, 1);
+#if PARPADEO_ACTIVO
+    crearTarea(tareaParpadeo, "Parpadeo", 2048, NULL, 1);
+#endif
+    crearTarea(tareaMostrar, "Mostrar", 2048, NULL, 1);
+    crearTarea(tareaCrearTrama, "CrearTrama", 4096, NULL, 1);
+    crearTarea(tareaMostrarTrama, "MostrarTrama", 4096, NULL, 1);
+    crearTarea(tareaEnlaceRx, "EnlaceRx", 2048, NULL, 1);
+#if SYNC_ACTIVO
+    crearTarea(tareaSincronizacion, "Sincronizacion", 2048, NULL, 1, &tareaSincronizacionHandle);
+#endif
+#if CARGA_CONTROL_ACTIVO
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+      esp_register_freertos_idle_hook_for_cpu(cargaIdleHook, i);
+    }
+    crearTarea(tareaControlCarga, "ControlCarga", 2048, NULL, 3);
+#endif
+#if PERFIL_COLAS
+    crearTarea(tareaPerfilColas, "PerfilColas", 2048, NULL, 3);
+#endif
+    if (backfillActivo) {
+      crearTarea(tareaBackfill, "Backfill", 4096,
+                 (void *)(uintptr_t)(walEntregado + pendiente), 1);
+    }
+
     // Tarea para manejar el Deep Sleep
-    xTaskCreate([](void* pvParameters) {
+    crearTarea([](void* pvParameters) {
         while (1) {
-            Serial.println("Sistema en ejecución...");
+            if (!backfillActivo) {
+              xSemaphoreTake(enlaceMutex, portMAX_DELAY);
+              Serial.println("Sistema en ejecución...");
+              xSemaphoreGive(enlaceMutex);
+            }
             vTaskDelay(pdMS_TO_TICKS(10000));
+            while (backfillActivo) vTaskDelay(pdMS_TO_TICKS(500));
             enterDeepSleep();
         }
-        }, "GestionSleep", 1024, NULL, 1, NULL);
+        }, "GestionSleep", 4096, NULL, 1);
 }
 
 /**
@@ -0,0 +1,331 @@
+/**
+ * @file esquema_trama.h
+ * @brief Esquema de bits de las tramas y codificador/decodificador generado
+ *
+ * Este archivo no depende de Arduino ni de FreeRTOS: el firmware lo usa para
+ * codificar y un decodificador en el host puede incluirlo tal cual, así
+ * ambos lados comparten la misma descripción de los campos.
+ */
+
+#ifndef ESQUEMA_TRAMA_H
+#define ESQUEMA_TRAMA_H
+
+#include <stdint.h>
+#include <type_traits>
+
+// Cuantización por canal: paso y rango físico; los bits salen del rango
+// (más el código reservado para "sin lectura")
+#define CUANT_SIN_LECTURA -1.0f        ///< Valor que marca un canal sin lectura
+#define CUANT_TEMPERATURA_PASO 0.25f   ///< Paso de temperatura en °C (el DS3231 resuelve 0.25 °C)
+#define CUANT_TEMPERATURA_MIN -40.125f ///< Temperatura mínima en °C (rejilla desplazada medio paso: -1 °C no es reconstruible)
+#define CUANT_TEMPERATURA_MAX 85.0f    ///< Temperatura máxima representable en °C
+#define CUANT_HUMEDAD_PASO 1.0f        ///< Paso de humedad en % (resolución del DHT11)
+#define CUANT_HUMEDAD_MIN 0.0f         ///< Humedad mínima en %
+#define CUANT_HUMEDAD_MAX 100.0f       ///< Humedad máxima en %
+#define CUANT_LUZ_PASO 8.0f            ///< Paso de luz en cuentas del ADC (por debajo del ruido del ADC)
+#define CUANT_LUZ_MIN 0.0f             ///< Luz mínima (cuentas del ADC)
+#define CUANT_LUZ_MAX 4095.0f          ///< Luz máxima (fondo de escala del ADC de 12 bits)
+
+/**
+ * @struct CampoEsquema
+ * @brief Descripción de un campo empaquetado
+ *
+ * El valor físico v se guarda como entero sin signo de bits bits:
+ * crudo = base + redondeo((v - offset) / escala), saturado a
+ * [base, 2^bits - 1], y se reconstruye como (crudo - base) * escala + offset.
+ * Con sinLectura el crudo 0 queda reservado para CUANT_SIN_LECTURA (base 1),
+ * así ninguna lectura real se confunde con la ausencia de lectura.
+ */
+struct CampoEsquema {
+  uint8_t bits;     ///< Anchura del campo (1 a 25)
+  float escala;     ///< Valor físico de una unidad del campo
+  float offset;     ///< Valor físico del primer crudo de datos
+  bool sinLectura;  ///< El crudo 0 codifica CUANT_SIN_LECTURA
+};
+
+/**
+ * @brief Bits necesarios para representar niveles valores distintos
+ */
+constexpr uint8_t bitsPara(uint32_t niveles, uint8_t bits = 1) {
+  return (1UL << bits) >= niveles ? bits : bitsPara(niveles, bits + 1);
+}
+
+/**
+ * @brief Número de niveles de paso paso que cubren [minimo, maximo]
+ */
+constexpr uint32_t nivelesPara(float intervalos) {
+  return (uint32_t)intervalos + ((float)(uint32_t)intervalos < intervalos ? 1 : 0) + 1;
+}
+
+/**
+ * @brief Campo que cubre [minimo, maximo] con paso paso, el código de
+ * "sin lectura" y los bits justos
+ */
+constexpr CampoEsquema campoCuantizado(float paso, float minimo, float maximo) {
+  return CampoEsquema{bitsPara(nivelesPara((maximo - minimo) / paso) + 1), paso, minimo, true};
+}
+
+/**
+ * @brief Decimales necesarios para mostrar sin pérdida un múltiplo de paso (máximo 2)
+ */
+constexpr int decimalesPara(float paso, int decimales = 0, float escala = 1) {
+  return decimales == 2 || (float)(long)(paso * escala) == paso * escala
+           ? decimales
+           : decimalesPara(paso, decimales + 1, escala * 10);
+}
+
+/**
+ * @class CodificadorBits
+ * @brief Codificador y decodificador de un esquema de campos consecutivos
+ *
+ * Esquema debe declarar un array estático constexpr campos. Los campos se
+ * escriben seguidos, en orden, empezando por el bit menos significativo del
+ * primer byte. Las posiciones se calculan en compilación y la codificación
+ * se desenrolla campo a campo, así cada uno se reduce a desplazamientos y
+ * OR fijos sin saltos que dependan de los datos.
+ */
+template <class Esquema>
+class CodificadorBits {
+ public:
+  static constexpr int CAMPOS = sizeof(Esquema::campos) / sizeof(Esquema::campos[0]);  ///< Número de campos
+
+  /**
+   * @brief Posición en bits del campo i (o el total de bits si i == CAMPOS)
+   */
+  static constexpr int desplazamiento(int i) {
+    return i == 0 ? 0 : desplazamiento(i - 1) + Esquema::campos[i - 1].bits;
+  }
+
+  static constexpr int BITS = desplazamiento(CAMPOS);  ///< Bits de una trama
+  static constexpr int BYTES = (BITS + 7) / 8;         ///< Bytes de una trama
+
+  /**
+   * @brief Máximo crudo representable en el campo i
+   */
+  static constexpr uint32_t maximo(int i) {
+    return (1UL << Esquema::campos[i].bits) - 1;
+  }
+
+  /**
+   * @brief Primer crudo de datos del campo i (1 si el 0 está reservado)
+   */
+  static constexpr uint32_t primero(int i) {
+    return Esquema::campos[i].sinLectura ? 1 : 0;
+  }
+
+  /**
+   * @brief Convierte un valor físico en el crudo del campo i (con saturación)
+   */
+  static constexpr uint32_t cuantizar(int i, float valor) {
+    return Esquema::campos[i].sinLectura && valor == CUANT_SIN_LECTURA
+             ? 0
+             : primero(i) + cuantizarEscalado(i, (valor - Esquema::campos[i].offset) / Esquema::campos[i].escala + 0.5f);
+  }
+
+  /**
+   * @brief Reconstruye el valor físico de un crudo del campo i
+   */
+  static constexpr float reconstruir(int i, uint32_t crudo) {
+    return crudo < primero(i) ? CUANT_SIN_LECTURA
+                              : (crudo - primero(i)) * Esquema::campos[i].escala + Esquema::campos[i].offset;
+  }
+
+  /**
+   * @brief Cota del error de reconstrucción del campo i dentro de su rango
+   *
+   * Para v en [reconstruir(i, primero(i)), reconstruir(i, maximo(i))],
+   * |reconstruir(i, cuantizar(i, v)) - v| <= escala / 2. Fuera del rango el
+   * valor satura al extremo más cercano.
+   */
+  static constexpr float errorMaximo(int i) {
+    return Esquema::campos[i].escala / 2;
+  }
+
+  /**
+   * @brief Empaqueta CAMPOS valores físicos en BYTES bytes
+   */
+  static void codificar(const float *valores, uint8_t *salida) {
+    for (int b = 0; b < BYTES; b++) salida[b] = 0;
+    codificarDesde(valores, salida, std::integral_constant<int, 0>());
+  }
+
+  /**
+   * @brief Desempaqueta BYTES bytes en CAMPOS valores físicos
+   */
+  static void decodificar(const uint8_t *entrada, float *valores) {
+    decodificarDesde(entrada, valores, std::integral_constant<int, 0>());
+  }
+
+  /**
+   * @brief Comprueba en compilación la ida y vuelta de los campos desde i
+   *
+   * Para cada campo, el primer crudo de datos, el siguiente y el máximo
+   * deben sobrevivir a reconstruir + cuantizar, y valores fuera de rango
+   * deben saturar a un crudo de datos. Con sinLectura, CUANT_SIN_LECTURA va
+   * al crudo 0 y ningún crudo de datos reconstruye ese valor.
+   */
+  static constexpr bool idaVuelta(int i = 0) {
+    return i == CAMPOS ||
+           (Esquema::campos[i].bits >= 1 && Esquema::campos[i].bits <= 25 &&
+            Esquema::campos[i].escala > 0 &&
+            cuantizar(i, reconstruir(i, primero(i))) == primero(i) &&
+            cuantizar(i, reconstruir(i, primero(i) + 1)) == primero(i) + 1 &&
+            cuantizar(i, reconstruir(i, maximo(i))) == maximo(i) &&
+            cuantizar(i, reconstruir(i, primero(i)) - Esquema::campos[i].escala * 4) == primero(i) &&
+            cuantizar(i, reconstruir(i, maximo(i)) + Esquema::campos[i].escala * 4) == maximo(i) &&
+            (!Esquema::campos[i].sinLectura ||
+             (cuantizar(i, CUANT_SIN_LECTURA) == 0 && reconstruir(i, 0) == CUANT_SIN_LECTURA &&
+              centinelaLibre(i, (CUANT_SIN_LECTURA - Esquema::campos[i].offset) / Esquema::campos[i].escala))) &&
+            idaVuelta(i + 1));
+  }
+
+ private:
+  static constexpr uint32_t cuantizarEscalado(int i, float escalado) {
+    return escalado < 1.0f ? 0
+         : escalado >= (float)(maximo(i) - primero(i)) ? maximo(i) - primero(i)
+         : (uint32_t)escalado;
+  }
+
+  /**
+   * @brief Ningún crudo de datos del campo i reconstruye CUANT_SIN_LECTURA
+   *
+   * pasos es la posición de CUANT_SIN_LECTURA en la rejilla del campo; basta
+   * con comprobar los dos crudos de datos que la rodean.
+   */
+  static constexpr bool centinelaLibre(int i, float pasos) {
+    return pasos < 0 || pasos > (float)(maximo(i) - primero(i)) ||
+           (reconstruir(i, primero(i) + (uint32_t)pasos) != CUANT_SIN_LECTURA &&
+            ((uint32_t)pasos + 1 > maximo(i) - primero(i) ||
+             reconstruir(i, primero(i) + (uint32_t)pasos + 1) != CUANT_SIN_LECTURA));
+  }
+
+  /**
+   * @brief Escribe el crudo del campo I en su posición fija
+   */
+  template <int I>
+  static void escribir(uint8_t *salida, uint32_t crudo) {
+    constexpr int inicio = desplazamiento(I) / 8;
+    constexpr int corrimiento = desplazamiento(I) % 8;
+    constexpr int bytes = (corrimiento + Esquema::campos[I].bits + 7) / 8;
+    uint32_t palabra = crudo << corrimiento;
+    for (int b = 0; b < bytes; b++) salida[inicio + b] |= (uint8_t)(palabra >> (8 * b));
+  }
+
+  /**
+   * @brief Lee el crudo del campo I de su posición fija
+   */
+  template <int I>
+  static uint32_t leer(const uint8_t *entrada) {
+    constexpr int inicio = desplazamiento(I) / 8;
+    constexpr int corrimiento = desplazamiento(I) % 8;
+    constexpr int bytes = (corrimiento + Esquema::campos[I].bits + 7) / 8;
+    uint32_t palabra = 0;
+    for (int b = 0; b < bytes; b++) palabra |= (uint32_t)entrada[inicio + b] << (8 * b);
+    return (palabra >> corrimiento) & maximo(I);
+  }
+
+  static void codificarDesde(const float *, uint8_t *, std::integral_constant<int, CAMPOS>) {}
+
+  template <int I>
+  static void codificarDesde(const float *valores, uint8_t *salida, std::integral_constant<int, I>) {
+    escribir<I>(salida, cuantizar(I, valores[I]));
+    codificarDesde(valores, salida, std::integral_constant<int, I + 1>());
+  }
+
+  static void decodificarDesde(const uint8_t *, float *, std::integral_constant<int, CAMPOS>) {}
+
+  template <int I>
+  static void decodificarDesde(const uint8_t *entrada, float *valores, std::integral_constant<int, I>) {
+    valores[I] = reconstruir(I, leer<I>(entrada));
+    decodificarDesde(entrada, valores, std::integral_constant<int, I + 1>());
+  }
+};
+
+/**
+ * @enum CampoTrama
+ * @brief Índices de los campos de EsquemaTrama
+ */
+enum CampoTrama {
+  CAMPO_ANIO,         ///< Año
+  CAMPO_MES,          ///< Mes
+  CAMPO_DIA,          ///< Día del mes
+  CAMPO_HORA,         ///< Hora
+  CAMPO_MINUTO,       ///< Minutos
+  CAMPO_SEGUNDO,      ///< Segundos
+  CAMPO_TEMPERATURA,  ///< Temperatura (°C, -1 sin lectura)
+  CAMPO_HUMEDAD,      ///< Humedad (%, -1 sin lectura)
+  CAMPO_LUZ,          ///< Nivel de luz del ADC (-1 sin lectura)
+};
+
+/**
+ * @struct EsquemaTramaV1
+ * @brief Primera versión del esquema (10 bytes, medidas en centésimas)
+ *
+ * Ya no se escribe; se conserva para decodificar los registros que queden
+ * en el WAL o lleguen por backfill desde un firmware anterior. No reserva
+ * código para "sin lectura": el -1 se guarda como un valor más.
+ */
+struct EsquemaTramaV1 {
+  static constexpr CampoEsquema campos[] = {
+    {7, 1, 2000, false},           // 2000..2127
+    {4, 1, 0, false},              // 0..15
+    {5, 1, 0, false},              // 0..31
+    {5, 1, 0, false},              // 0..31
+    {6, 1, 0, false},              // 0..63
+    {6, 1, 0, false},              // 0..63
+    {14, 0.01f, -40.96f, false},   // -40.96..122.87 °C
+    {14, 0.01f, -1.0f, false},     // -1.00..162.83 %
+    {13, 1, -1, false},            // -1..8190
+  };
+};
+
+/**
+ * @struct EsquemaTrama
+ * @brief Campos de una trama de medidas, versión actual (el número de secuencia va aparte)
+ *
+ * La fecha y la hora se guardan exactas. Las medidas se cuantizan con el
+ * paso de su canal (CUANT_*), que no es más fino que la resolución real del
+ * sensor, así los bits que se quitan solo llevaban ruido.
+ */
+struct EsquemaTrama {
+  static constexpr CampoEsquema campos[] = {
+    {7, 1, 2000, false},  // 2000..2127
+    {4, 1, 0, false},     // 0..15
+    {5, 1, 0, false},     // 0..31
+    {5, 1, 0, false},     // 0..31
+    {6, 1, 0, false},     // 0..63
+    {6, 1, 0, false},     // 0..63
+    campoCuantizado(CUANT_TEMPERATURA_PASO, CUANT_TEMPERATURA_MIN, CUANT_TEMPERATURA_MAX),
+    campoCuantizado(CUANT_HUMEDAD_PASO, CUANT_HUMEDAD_MIN, CUANT_HUMEDAD_MAX),
+    campoCuantizado(CUANT_LUZ_PASO, CUANT_LUZ_MIN, CUANT_LUZ_MAX),
+  };
+};
+
+#if __cplusplus < 201703L
+constexpr CampoEsquema EsquemaTramaV1::campos[];
+constexpr CampoEsquema EsquemaTrama::campos[];
+#endif
+
+typedef CodificadorBits<EsquemaTramaV1> CodificadorTramaV1;  ///< Decodificador de tramas de la versión 1
+typedef CodificadorBits<EsquemaTrama> CodificadorTrama;      ///< Codificador de las tramas de medidas
+
+static_assert(CodificadorTramaV1::CAMPOS == CAMPO_LUZ + 1 && CodificadorTramaV1::BITS == 74,
+              "la versión 1 del esquema no debe cambiar");
+
+static_assert(CodificadorTrama::CAMPOS == CAMPO_LUZ + 1, "EsquemaTrama y CampoTrama no coinciden");
+static_assert(CodificadorTrama::BITS == 59, "cambio inesperado en la anchura de la trama");
+static_assert(CodificadorTrama::idaVuelta(), "un campo de EsquemaTrama no sobrevive a la ida y vuelta");
+static_assert(CodificadorTrama::reconstruir(CAMPO_TEMPERATURA, CodificadorTrama::maximo(CAMPO_TEMPERATURA)) >= CUANT_TEMPERATURA_MAX &&
+              CodificadorTrama::reconstruir(CAMPO_HUMEDAD, CodificadorTrama::maximo(CAMPO_HUMEDAD)) >= CUANT_HUMEDAD_MAX &&
+              CodificadorTrama::reconstruir(CAMPO_LUZ, CodificadorTrama::maximo(CAMPO_LUZ)) >= CUANT_LUZ_MAX,
+              "los bits de un canal no cubren su rango");
+static_assert(CodificadorTrama::cuantizar(CAMPO_TEMPERATURA, CUANT_SIN_LECTURA) == 0 &&
+              CodificadorTrama::cuantizar(CAMPO_HUMEDAD, CUANT_SIN_LECTURA) == 0 &&
+              CodificadorTrama::cuantizar(CAMPO_LUZ, CUANT_SIN_LECTURA) == 0 &&
+              CodificadorTrama::cuantizar(CAMPO_TEMPERATURA, -1.01f) != 0 &&
+              CodificadorTrama::cuantizar(CAMPO_TEMPERATURA, -0.99f) != 0 &&
+              CodificadorTrama::cuantizar(CAMPO_LUZ, 0) != 0 &&
+              CodificadorTrama::cuantizar(CAMPO_HUMEDAD, 0) != 0,
+              "solo CUANT_SIN_LECTURA debe ir al código reservado de cada canal");
+
+#endif
@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+"""Huella de memoria por módulo y por símbolo a partir del .map del enlazador.
+
+Lee el .map que arduino-cli / arduino-esp32 ya generan en la carpeta de
+compilación (<build-path>/<sketch>.ino.map), reparte cada sección de entrada
+entre IRAM, DRAM, RTC y FLASH según la sección de salida que la contiene y la
+asigna a un módulo por el objeto de origen (DHT, RTClib, printf con coma
+flotante, el propio sketch...). Muestra los totales por módulo y región, los
+símbolos más grandes y compara con los presupuestos.
+
+Uso:
+    huella_map.py FreeRTOS.ino.map
+    huella_map.py FreeRTOS.ino.map --simbolos 20 \\
+        --presupuesto DHT:FLASH=4096 --presupuesto total:DRAM=65536
+
+Las líneas de salida empiezan por "HUELLA_MAP" para compararlas entre
+commits igual que las líneas "HUELLA" del informe en tiempo de ejecución.
+
+Código de salida: 0 dentro de presupuesto, 1 si se supera alguno, 2 si el
+.map no se puede leer o los argumentos no son válidos.
+"""
+
+import argparse
+import re
+import sys
+from collections import defaultdict
+
+REGIONES = ("IRAM", "DRAM", "RTC", "FLASH")
+
+# Región de cada sección de salida del enlazador del ESP32
+SECCIONES = (
+    (re.compile(r"^\.iram0\."), "IRAM"),
+    (re.compile(r"^\.dram0\.|^\.noinit$|^\.ext_ram"), "DRAM"),
+    (re.compile(r"^\.rtc"), "RTC"),
+    (re.compile(r"^\.flash\."), "FLASH"),
+)
+
+# Módulos por defecto: nombre y expresión sobre la ruta del objeto de origen
+MODULOS = (
+    ("DHT", r"DHT"),
+    ("RTClib", r"RTClib"),
+    ("printf_float", r"vfprintf|svfprintf|_printf_float|dtoa|mprec|_ldtoa|ecvtbuf|fcvt"),
+    ("sketch", r"FreeRTOS\.(?:ino|cpp)"),
+    ("FreeRTOS", r"libfreertos|/freertos/"),
+    ("arduino", r"core\.a|cores/esp32"),
+)
+
+# Presupuestos por defecto (mismos valores que HUELLA_ESTATICA_MAX y
+# HUELLA_FLASH_MAX en FreeRTOS.cpp)
+PRESUPUESTOS = {
+    ("total", "DRAM"): 65536,
+    ("total", "FLASH"): 1048576,
+}
+
+SALIDA = re.compile(r"^(\.\S+)(?:\s+0x[0-9a-fA-F]+\s+0x[0-9a-fA-F]+)?")
+ENTRADA = re.compile(r"^ (\S+)(?:\s+(0x[0-9a-fA-F]+)\s+(0x[0-9a-fA-F]+)\s+(\S.*))?$")
+CONTINUACION = re.compile(r"^\s+(0x[0-9a-fA-F]+)\s+(0x[0-9a-fA-F]+)\s+(\S.*)$")
+SIMBOLO = re.compile(r"^\s+0x[0-9a-fA-F]+\s+(?!0x)(\S.*?)\s*$")
+
+
+def region_de(seccion):
+    for patron, region in SECCIONES:
+        if patron.search(seccion):
+            return region
+    return None
+
+
+def leer_map(ruta):
+    """Devuelve una lista de (región, objeto, símbolo, bytes)."""
+    with open(ruta, encoding="utf-8", errors="replace") as f:
+        lineas = f.read().splitlines()
+    try:
+        inicio = next(i for i, l in enumerate(lineas) if l.startswith("Linker script and memory map"))
+    except StopIteration:
+        raise ValueError("no parece un .map de GNU ld (falta 'Linker script and memory map')")
+
+    entradas = []
+    region = None
+    pendiente = None  # sección de entrada cuyo tamaño está en la línea siguiente
+    ultima = None     # última entrada, para darle nombre con la línea de símbolo
+    for linea in lineas[inicio + 1:]:
+        if not linea:
+            continue
+        m = SALIDA.match(linea)
+        if m:
+            region = region_de(m.group(1))
+            pendiente = ultima = None
+            continue
+        if region is None:
+            continue
+        if pendiente is not None:
+            m = CONTINUACION.match(linea)
+            if m:
+                ultima = [region, m.group(3).strip(), pendiente, int(m.group(2), 16)]
+                entradas.append(ultima)
+            pendiente = None
+            continue
+        m = ENTRADA.match(linea)
+        if m and not m.group(1).startswith(("*", "0x")):
+            if m.group(2) is None:
+                pendiente = m.group(1)
+            else:
+                ultima = [region, m.group(4).strip(), m.group(1), int(m.group(3), 16)]
+                entradas.append(ultima)
+            continue
+        m = SIMBOLO.match(linea)
+        if (m and ultima is not None and ultima[2].startswith(".")
+                and "=" not in m.group(1) and not m.group(1).startswith("PROVIDE")):
+            ultima[2] = m.group(1)
+    return [tuple(e) for e in entradas if e[3] > 0]
+
+
+def modulo_de(objeto, modulos):
+    for nombre, patron in modulos:
+        if patron.search(objeto):
+            return nombre
+    return "otros"
+
+
+def leer_presupuesto(texto):
+    m = re.match(r"^([\w.]+):(IRAM|DRAM|RTC|FLASH)=(\d+)$", texto)
+    if not m:
+        raise argparse.ArgumentTypeError("se esperaba MODULO:REGION=bytes, p. ej. DHT:FLASH=4096")
+    return (m.group(1), m.group(2)), int(m.group(3))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("mapa", help="fichero .map generado al enlazar")
+    parser.add_argument("--simbolos", type=int, default=10,
+                        help="símbolos más grandes a listar por región (0: ninguno)")
+    parser.add_argument("--modulo", action="append", default=[], metavar="NOMBRE=REGEX",
+                        help="módulo adicional (se evalúa antes que los predefinidos)")
+    parser.add_argument("--presupuesto", action="append", default=[], type=leer_presupuesto,
+                        metavar="MODULO:REGION=BYTES",
+                        help="presupuesto de un módulo o del total ('total') en una región")
+    args = parser.parse_args()
+
+    modulos = []
+    for definicion in args.modulo:
+        nombre, _, patron = definicion.partition("=")
+        if not nombre or not patron:
+            parser.error("--modulo espera NOMBRE=REGEX")
+        modulos.append((nombre, re.compile(patron)))
+    modulos += [(nombre, re.compile(patron)) for nombre, patron in MODULOS]
+
+    presupuestos = dict(PRESUPUESTOS)
+    presupuestos.update(args.presupuesto)
+
+    try:
+        entradas = leer_map(args.mapa)
+    except (OSError, ValueError) as e:
+        print("HUELLA_MAP error %s" % e, file=sys.stderr)
+        return 2
+
+    por_modulo = defaultdict(lambda: defaultdict(int))
+    por_simbolo = defaultdict(lambda: defaultdict(int))
+    for region, objeto, simbolo, tam in entradas:
+        modulo = modulo_de(objeto, modulos)
+        por_modulo[modulo][region] += tam
+        por_modulo["total"][region] += tam
+        por_simbolo[region][(modulo, simbolo)] += tam
+
+    for modulo in sorted(por_modulo, key=lambda m: (m == "total", m)):
+        regiones = por_modulo[modulo]
+        print("HUELLA_MAP modulo %s %s" % (modulo, " ".join(
+            "%s %d" % (r, regiones.get(r, 0)) for r in REGIONES)))
+
+    if args.simbolos > 0:
+        for region in REGIONES:
+            mayores = sorted(por_simbolo[region].items(), key=lambda e: -e[1])[:args.simbolos]
+            for (modulo, simbolo), tam in mayores:
+                print("HUELLA_MAP simbolo %s %s %s %d" % (region, modulo, simbolo, tam))
+
+    excedidos = 0
+    for (modulo, region), limite in sorted(presupuestos.items()):
+        usado = por_modulo.get(modulo, {}).get(region, 0)
+        if usado > limite:
+            print("HUELLA_MAP_EXCEDIDA %s %s %d > %d" % (modulo, region, usado, limite))
+            excedidos += 1
+    return 1 if excedidos else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
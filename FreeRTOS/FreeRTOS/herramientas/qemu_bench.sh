@@ -0,0 +1,93 @@
+#!/usr/bin/env bash
+# Ejecuta la imagen completa en el emulador QEMU del ESP32 y guarda las
+# medidas BENCH_TAREA del commit actual.
+#
+# Pasos:
+#   1. Copia el sketch a un directorio temporal con SIMULAR_PERIFERICOS y
+#      BENCH_TAREAS activados (QEMU no emula el DHT11, el ADC ni el DS3231)
+#   2. Compila con arduino-cli
+#   3. Une bootloader, tabla de particiones, boot_app0 y aplicación en una
+#      imagen de flash de 4 MB con esptool merge_bin
+#   4. Arranca qemu-system-xtensa (fork de Espressif) durante QEMU_SEGUNDOS
+#   5. Guarda las líneas BENCH_TAREA y HUELLA en <salida>/<commit>.txt
+#
+# Uso:
+#   herramientas/qemu_bench.sh [directorio de salida]
+#
+# Variables de entorno:
+#   FQBN           placa (por defecto esp32:esp32:esp32)
+#   QEMU           ejecutable de QEMU (por defecto qemu-system-xtensa)
+#   QEMU_SEGUNDOS  tiempo de ejecución en el emulador (por defecto 30)
+#   BOOT_APP0      ruta de boot_app0.bin (por defecto se busca en ~/.arduino15)
+#
+# Termina con error si la compilación o el emulador fallan, si no aparece
+# ninguna línea BENCH_TAREA, si el benchmark informa de un error o si el
+# informe marca HUELLA_EXCEDIDA.
+
+set -euo pipefail
+
+SKETCH_DIR="$(cd "$(dirname "$0")/.." && pwd)"
+SALIDA="${1:-$SKETCH_DIR/bench_tareas}"
+FQBN="${FQBN:-esp32:esp32:esp32}"
+QEMU="${QEMU:-qemu-system-xtensa}"
+QEMU_SEGUNDOS="${QEMU_SEGUNDOS:-30}"
+
+for herramienta in arduino-cli esptool.py "$QEMU"; do
+  command -v "$herramienta" >/dev/null || { echo "Falta $herramienta en el PATH" >&2; exit 2; }
+done
+
+TMP="$(mktemp -d)"
+trap 'rm -rf "$TMP"' EXIT
+
+# 1. Sketch con periféricos simulados y benchmark de tareas
+mkdir -p "$TMP/FreeRTOS"
+cp "$SKETCH_DIR/FreeRTOS.cpp" "$TMP/FreeRTOS/FreeRTOS.ino"
+cp "$SKETCH_DIR/esquema_trama.h" "$TMP/FreeRTOS/"
+sed -i -e 's/^#define SIMULAR_PERIFERICOS [0-9]*/#define SIMULAR_PERIFERICOS 1/' \
+       -e 's/^#define BENCH_TAREAS [0-9]*/#define BENCH_TAREAS 1/' \
+       "$TMP/FreeRTOS/FreeRTOS.ino"
+
+# 2. Compilación
+arduino-cli compile --fqbn "$FQBN" --build-path "$TMP/build" "$TMP/FreeRTOS"
+
+# 3. Imagen de flash
+BOOT_APP0="${BOOT_APP0:-$(find "$HOME/.arduino15/packages/esp32/hardware/esp32" \
+  -name boot_app0.bin -path '*partitions*' 2>/dev/null | sort | tail -n 1)}"
+[ -f "$BOOT_APP0" ] || { echo "No se encontró boot_app0.bin (use BOOT_APP0=...)" >&2; exit 2; }
+esptool.py --chip esp32 merge_bin --fill-flash-size 4MB -o "$TMP/flash.bin" \
+  0x1000 "$TMP/build/FreeRTOS.ino.bootloader.bin" \
+  0x8000 "$TMP/build/FreeRTOS.ino.partitions.bin" \
+  0xe000 "$BOOT_APP0" \
+  0x10000 "$TMP/build/FreeRTOS.ino.bin"
+
+# 4. Ejecución en el emulador (timeout termina QEMU con código 124)
+set +e
+timeout "$QEMU_SEGUNDOS" "$QEMU" -nographic -machine esp32 \
+  -drive "file=$TMP/flash.bin,if=mtd,format=raw" > "$TMP/serie.txt" 2>&1
+codigo=$?
+set -e
+if [ "$codigo" -ne 0 ] && [ "$codigo" -ne 124 ]; then
+  cat "$TMP/serie.txt" >&2
+  echo "QEMU terminó con código $codigo" >&2
+  exit 1
+fi
+
+# 5. Resultados del commit
+COMMIT="$(git -C "$SKETCH_DIR" rev-parse --short HEAD 2>/dev/null || echo sin-commit)"
+mkdir -p "$SALIDA"
+grep -a -E '^(BENCH_TAREA|HUELLA)' "$TMP/serie.txt" > "$SALIDA/$COMMIT.txt" || true
+echo "Resultados en $SALIDA/$COMMIT.txt"
+
+if ! grep -q '^BENCH_TAREA' "$SALIDA/$COMMIT.txt"; then
+  cat "$TMP/serie.txt" >&2
+  echo "No se obtuvo ninguna línea BENCH_TAREA" >&2
+  exit 1
+fi
+if grep -q '^BENCH_TAREA error' "$SALIDA/$COMMIT.txt"; then
+  echo "Falló la comprobación de ida y vuelta del empaquetado" >&2
+  exit 1
+fi
+if grep -q 'HUELLA_EXCEDIDA' "$SALIDA/$COMMIT.txt"; then
+  echo "Presupuesto de memoria superado" >&2
+  exit 1
+fi
@@ -0,0 +1,195 @@
+/**
+ * @file rango_secuencias.h
+ * @brief Conjunto compacto de números de secuencia recibidos (lado del host)
+ *
+ * Igual que esquema_trama.h, este archivo no depende de Arduino ni de
+ * FreeRTOS: es la contraparte en el host de los números de secuencia que el
+ * firmware pone en cada trama ('#<seq>'). La ingesta del host guarda lo
+ * recibido como rangos disjuntos, descarta los duplicados (reconexiones,
+ * backfill, retransmisiones) y lista los huecos para pedirlos con 'N<seq>';
+ * el final del primer rango es lo que puede confirmar con 'A<seq>'.
+ */
+
+#ifndef RANGO_SECUENCIAS_H
+#define RANGO_SECUENCIAS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @class RangoSecuencias
+ * @brief Rangos cerrados y disjuntos de secuencias recibidas, en orden
+ *
+ * Sin memoria dinámica: caben MAX rangos, es decir, MAX - 1 huecos
+ * abiertos a la vez. Una trama en orden solo alarga el último rango (O(1));
+ * una fuera de orden se busca por bisección y, si abre o cierra un hueco,
+ * desplaza los rangos siguientes, que son pocos mientras se piden y llegan
+ * las retransmisiones. Todo lo anterior a base() se da por liquidado
+ * (recibido o abandonado con olvidarHasta) y cuenta como duplicado.
+ *
+ * Las comparaciones son directas, sin aritmética circular: con un contador
+ * de 32 bits por equipo el desbordamiento no llega en la vida útil.
+ */
+template <size_t MAX>
+class RangoSecuencias {
+ public:
+  static_assert(MAX >= 1, "RangoSecuencias necesita al menos un rango");
+
+  /**
+   * @brief Resultado de anotar una secuencia
+   */
+  enum Resultado {
+    NUEVA,       ///< No se había recibido: hay que procesar la trama
+    DUPLICADA,   ///< Ya recibida o liquidada: se descarta
+    SIN_ESPACIO  ///< Abriría un hueco más de los que caben: no se anota
+  };
+
+  /**
+   * @struct Rango
+   * @brief Secuencias inicio..fin, ambas incluidas
+   */
+  struct Rango {
+    uint32_t inicio;  ///< Primera secuencia del rango
+    uint32_t fin;     ///< Última secuencia del rango
+  };
+
+  /**
+   * @brief Anota una secuencia recibida
+   */
+  Resultado insertar(uint32_t s) {
+    if (s < base_) return DUPLICADA;
+    // Caso habitual: llega la siguiente a la última
+    if (n_ > 0 && (uint64_t)rangos_[n_ - 1].fin + 1 == s) {
+      rangos_[n_ - 1].fin = s;
+      return NUEVA;
+    }
+    if (n_ == 0 || s > rangos_[n_ - 1].fin) {
+      if (n_ == MAX) return SIN_ESPACIO;
+      rangos_[n_++] = Rango{s, s};
+      return NUEVA;
+    }
+
+    size_t i = primeroQueAlcanza(s);
+    Rango &r = rangos_[i];
+    if (r.inicio <= s && s <= r.fin) return DUPLICADA;
+    if ((uint64_t)r.fin + 1 == s) {
+      r.fin = s;
+      if (i + 1 < n_ && (uint64_t)s + 1 == rangos_[i + 1].inicio) {
+        r.fin = rangos_[i + 1].fin;
+        borrar(i + 1);
+      }
+      return NUEVA;
+    }
+    if ((uint64_t)s + 1 == r.inicio) {
+      r.inicio = s;
+      return NUEVA;
+    }
+    if (n_ == MAX) return SIN_ESPACIO;
+    for (size_t k = n_; k > i; k--) rangos_[k] = rangos_[k - 1];
+    rangos_[i] = Rango{s, s};
+    n_++;
+    return NUEVA;
+  }
+
+  /**
+   * @brief Indica si la secuencia s ya se recibió (o está liquidada)
+   */
+  bool contiene(uint32_t s) const {
+    if (s < base_) return true;
+    if (n_ == 0 || s > rangos_[n_ - 1].fin) return false;
+    const Rango &r = rangos_[primeroQueAlcanza(s)];
+    return r.inicio <= s && s <= r.fin;
+  }
+
+  /**
+   * @brief Llama a f(desde, hasta) por cada hueco entre rangos, en orden
+   *
+   * Son las secuencias que faltan por detrás de la más alta recibida; el
+   * host las pide con un 'N' por secuencia. Devuelve el número de huecos.
+   */
+  template <class F>
+  size_t huecos(F f) const {
+    for (size_t i = 1; i < n_; i++) f(rangos_[i - 1].fin + 1, rangos_[i].inicio - 1);
+    return n_ > 0 ? n_ - 1 : 0;
+  }
+
+  /**
+   * @brief Secuencias que faltan en total entre los rangos
+   */
+  uint64_t perdidas() const {
+    uint64_t total = 0;
+    for (size_t i = 1; i < n_; i++) total += rangos_[i].inicio - rangos_[i - 1].fin - 1;
+    return total;
+  }
+
+  /**
+   * @brief Última secuencia recibida sin huecos delante
+   *
+   * Es la confirmación acumulativa ('A') que puede enviar el host. Sin
+   * rangos devuelve false.
+   */
+  bool contiguoHasta(uint32_t &s) const {
+    if (n_ == 0) return false;
+    s = rangos_[0].fin;
+    return true;
+  }
+
+  /**
+   * @brief Da por liquidadas todas las secuencias hasta s, incluida
+   *
+   * Sirve para renunciar a los huecos que el equipo ya no puede reenviar
+   * (o para olvidar lo confirmado hace tiempo) y liberar sus rangos. Lo
+   * liquidado queda como primer rango, así los huecos posteriores se siguen
+   * listando. Devuelve false, sin cambiar nada, si todos los rangos están
+   * por encima de s + 1 y no cabe uno más.
+   */
+  bool olvidarHasta(uint32_t s) {
+    if (s < base_) return true;
+    size_t fundir = 0;
+    uint32_t fin = s;
+    while (fundir < n_ && rangos_[fundir].inicio <= (uint64_t)s + 1) {
+      if (rangos_[fundir].fin > fin) fin = rangos_[fundir].fin;
+      fundir++;
+    }
+    if (fundir == 0) {
+      if (n_ == MAX) return false;
+      for (size_t k = n_; k > 0; k--) rangos_[k] = rangos_[k - 1];
+      n_++;
+      fundir = 1;
+    }
+    rangos_[0] = Rango{s, fin};
+    for (size_t k = fundir; k < n_; k++) rangos_[k - fundir + 1] = rangos_[k];
+    n_ -= fundir - 1;
+    base_ = s;
+    return true;
+  }
+
+  size_t rangos() const { return n_; }                      ///< Rangos en uso
+  const Rango &rango(size_t i) const { return rangos_[i]; }  ///< Rango i (0 <= i < rangos())
+  uint32_t base() const { return base_; }                   ///< Las anteriores están liquidadas
+
+ private:
+  /**
+   * @brief Primer rango cuyo fin + 1 alcanza s (existe si s <= fin del último)
+   */
+  size_t primeroQueAlcanza(uint32_t s) const {
+    size_t bajo = 0, alto = n_ - 1;
+    while (bajo < alto) {
+      size_t medio = (bajo + alto) / 2;
+      if ((uint64_t)rangos_[medio].fin + 1 < s) bajo = medio + 1;
+      else alto = medio;
+    }
+    return bajo;
+  }
+
+  void borrar(size_t i) {
+    for (size_t k = i + 1; k < n_; k++) rangos_[k - 1] = rangos_[k];
+    n_--;
+  }
+
+  Rango rangos_[MAX];
+  size_t n_ = 0;
+  uint32_t base_ = 0;
+};
+
+#endif